@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,10 +7,159 @@
 #include <signal.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <sys/stat.h>
 
 #define BG 111
 #define PIPE 222
 
+// chunk size for feeding a pipe from a file (splice or read/write fallback)
+#define FEED_CHUNK (1 << 20)
+
+// chunk size for reading the output of a command substitution
+#define SUBST_CHUNK (1 << 16)
+
+// file descriptors that a command's stdin/stdout/stderr are redirected to (-1 = inherited)
+typedef struct redirections{
+    int in;
+    int out;
+    int err;
+}redirections;
+
+/*
+Per pipeline tuning, set for a single command line by leading words:
+    PIPESZ=<bytes>[K|M]   capacity of each pipe (F_SETPIPE_SZ)
+    PIPESZ=max            capacity of /proc/sys/fs/pipe-max-size
+    PIPECPU=1             pin the stages to distinct cpus
+The PIPESZ and PIPECPU environment variables the shell is started with set the defaults
+ */
+typedef struct pipeline_options{
+    int pipe_size;   // 0 = the kernel's default capacity
+    int pin_cpus;
+}pipeline_options;
+
+pipeline_options default_pipeline_options;
+
+// the cpus the shell may run on, which pinned pipeline stages are spread over
+cpu_set_t allowed_cpus;
+
+/*
+The zygote is a helper process forked by prepare() while the shell is still small (enabled by
+the ZYGOTE=1 environment variable). Simple foreground and background commands are sent to it
+over a unix socket - argv in the message and the stdin/stdout/stderr to use as SCM_RIGHTS -
+and it forks/execs them from its minimal address space, so the launch cost doesn't grow with
+the shell's memory footprint. Pipelines are still forked by the shell.
+ */
+#define ZYGOTE_MAX_ARGS_LEN (1 << 16)
+
+typedef struct zygote_request{
+    int background;
+    int argc;
+    int len;    // bytes of the NUL separated argv that follows
+}zygote_request;
+
+// sent right after the fork for a background command, and when it exits for a foreground one
+typedef struct zygote_reply{
+    pid_t pid;  // -1 if fork failed
+    int status;
+}zygote_reply;
+
+int zygote_sock = -1;
+pid_t zygote_pid = -1;
+
+int start_zygote(void);
+void stop_zygote(void);
+
+// ---------------------- pipeline options ---------------------- //
+
+// Returns the system's maximal pipe capacity, or 0 if it can't be read
+int get_pipe_max_size(void){
+    int size = 0;
+    FILE* f = fopen("/proc/sys/fs/pipe-max-size", "r");
+
+    if(f == NULL)
+        return 0;
+
+    if(fscanf(f, "%d", &size) != 1)
+        size = 0;
+
+    fclose(f);
+    return size;
+}
+
+// Parses the value of PIPESZ. Returns -1 if it's invalid
+int parse_pipe_size(char* value){
+    char* end;
+    long size;
+    int shift = 0;
+
+    if(strcmp(value, "max") == 0)
+        return get_pipe_max_size();
+
+    errno = 0;
+    size = strtol(value, &end, 10);
+    if(errno != 0 || end == value || size < 0)
+        return -1;
+
+    if(*end == 'K' || *end == 'k'){
+        shift = 10;
+        end++;
+    }
+    else if(*end == 'M' || *end == 'm'){
+        shift = 20;
+        end++;
+    }
+
+    // checked before shifting, so a big value can't overflow
+    if(*end != '\0' || size > (1L << 30) >> shift)
+        return -1;
+
+    return (int)(size << shift);
+}
+
+// Sets a pipeline option by its name. Returns 1 if there's no such option
+int set_pipeline_option(char* name, char* value, pipeline_options* opts){
+    if(strcmp(name, "PIPESZ") == 0){
+        int size = parse_pipe_size(value);
+        if(size == -1)
+            fprintf(stderr, "invalid pipe size: %s\n", value);
+        else
+            opts -> pipe_size = size;
+        return 0;
+    }
+
+    if(strcmp(name, "PIPECPU") == 0){
+        opts -> pin_cpus = (atoi(value) != 0);
+        return 0;
+    }
+
+    return 1;
+}
+
+// Consumes the leading NAME=value option words of a command line. Returns how many there were
+int parse_pipeline_options(int count, char** arglist, pipeline_options* opts){
+    char name[16];
+    int i;
+
+    for(i = 0; i < count; i++){
+        char* eq = strchr(arglist[i], '=');
+        if(eq == NULL || eq - arglist[i] >= (long)sizeof(name))
+            break;
+
+        memcpy(name, arglist[i], eq - arglist[i]);
+        name[eq - arglist[i]] = '\0';
+
+        if(set_pipeline_option(name, eq + 1, opts))
+            break;
+    }
+
+    return i;
+}
+
 // initialization and setup for process_arglist
 int prepare(void){
 
@@ -24,10 +174,23 @@ int prepare(void){
         return 1;
     }
 
+    if(sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) == -1)
+        CPU_ZERO(&allowed_cpus);
+
+    memset(&default_pipeline_options, 0, sizeof(default_pipeline_options));
+    if(getenv("PIPESZ") != NULL)
+        set_pipeline_option("PIPESZ", getenv("PIPESZ"), &default_pipeline_options);
+    if(getenv("PIPECPU") != NULL)
+        set_pipeline_option("PIPECPU", getenv("PIPECPU"), &default_pipeline_options);
+
+    if(getenv("ZYGOTE") != NULL && atoi(getenv("ZYGOTE")) != 0 && start_zygote())
+        return 1;
+
     return 0;
 }
 
 int finalize(void){
+    stop_zygote();
     return 0;
 }
 
@@ -54,8 +217,397 @@ void sigchld_handler(int signum, siginfo_t *info, void *ptr){
     while(waitpid(-1, NULL, WNOHANG) > 0);
 }
 
-int run_cmd_bg(int count, char** arglist) {
-    arglist[count - 1] = NULL;
+// ---------------------- redirections ---------------------- //
+
+// Returns 1 if the given word is one of the redirection operators: <, >, >>, 2>
+int is_redirection(char* word){
+    return strcmp(word, "<") == 0 || strcmp(word, ">") == 0 ||
+           strcmp(word, ">>") == 0 || strcmp(word, "2>") == 0;
+}
+
+void close_redirections(redirections* r){
+    if(r -> in != -1)
+        close(r -> in);
+    if(r -> out != -1)
+        close(r -> out);
+    if(r -> err != -1)
+        close(r -> err);
+
+    r -> in = r -> out = r -> err = -1;
+}
+
+/*
+Opens the files of the redirections in arglist[start, end) and removes the operators and their
+file names from the command, which is then NULL terminated.
+The files are opened by the parent with O_CLOEXEC: a child dup2's the ones it needs onto 0/1/2,
+and every other copy is closed on exec, so no descriptor leaks into an unrelated command.
+Returns the new end of the command, -1 on a syntax error or -2 if a file can't be opened
+(nothing is left open on failure)
+ */
+int parse_redirections(int start, int end, char** arglist, redirections* r){
+    int w = start;
+    int fd;
+    int* target;
+
+    r -> in = r -> out = r -> err = -1;
+
+    for(int i = start; i < end; i++){
+        if(!is_redirection(arglist[i])){
+            arglist[w++] = arglist[i];
+            continue;
+        }
+
+        if(i + 1 >= end || is_redirection(arglist[i + 1])){
+            fprintf(stderr, "syntax error: missing file name after %s\n", arglist[i]);
+            close_redirections(r);
+            return -1;
+        }
+
+        if(strcmp(arglist[i], "<") == 0){
+            fd = open(arglist[i + 1], O_RDONLY | O_CLOEXEC);
+            target = &r -> in;
+        }
+        else if(strcmp(arglist[i], ">>") == 0){
+            fd = open(arglist[i + 1], O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+            target = &r -> out;
+        }
+        else{
+            fd = open(arglist[i + 1], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            target = (arglist[i][0] == '2') ? &r -> err : &r -> out;
+        }
+
+        if(fd == -1){
+            fprintf(stderr, "open failed for %s. Error: %s\n", arglist[i + 1], strerror(errno));
+            close_redirections(r);
+            return -2;
+        }
+
+        // the last redirection of a stream wins, as in sh
+        if(*target != -1)
+            close(*target);
+        *target = fd;
+
+        i++;
+    }
+
+    arglist[w] = NULL;
+    return w;
+}
+
+// Called by a child before exec. dup2 clears O_CLOEXEC on 0/1/2 only
+int apply_redirections(redirections* r){
+    if(r -> in != -1 && dup2(r -> in, STDIN_FILENO) == -1){
+        fprintf(stderr, "dup2 failed. Error: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if(r -> out != -1 && dup2(r -> out, STDOUT_FILENO) == -1){
+        fprintf(stderr, "dup2 failed. Error: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if(r -> err != -1 && dup2(r -> err, STDERR_FILENO) == -1){
+        fprintf(stderr, "dup2 failed. Error: %s\n", strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+// ---------------------- zygote ---------------------- //
+
+// Receives a request and its 3 descriptors. Returns the number of bytes received (0 on EOF) or -1
+ssize_t zygote_recv(int sock, zygote_request* req, char* args, int fds[3]){
+    struct iovec iov[2] = {{req, sizeof(*req)}, {args, ZYGOTE_MAX_ARGS_LEN}};
+    char control[CMSG_SPACE(sizeof(int) * 3)];
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    do{
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    }while(n == -1 && errno == EINTR);
+
+    if(n <= 0)
+        return n;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if(n < (ssize_t)sizeof(*req) || cmsg == NULL || cmsg -> cmsg_type != SCM_RIGHTS ||
+       cmsg -> cmsg_len != CMSG_LEN(sizeof(int) * 3)){
+        errno = EPROTO;
+        return -1;
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * 3);
+    return n;
+}
+
+// Only interrupts the zygote's ppoll, which then reaps the background commands
+void zygote_sigchld_handler(int signum){
+}
+
+// Returns 1 if args (len bytes) are exactly argc NUL terminated strings
+int valid_args(char* args, int len, int argc){
+    int nuls = 0;
+
+    if(len <= 0 || args[len - 1] != '\0')
+        return 0;
+
+    for(int i = 0; i < len; i++)
+        nuls += (args[i] == '\0');
+
+    return argc > 0 && nuls == argc;
+}
+
+// The zygote's main loop. Exits when the shell closes its end of the socket
+void zygote_main(int sock){
+    zygote_request req;
+    zygote_reply reply;
+    char* args = malloc(ZYGOTE_MAX_ARGS_LEN);
+    char** argv = malloc(sizeof(char*) * (ZYGOTE_MAX_ARGS_LEN + 1));
+    struct pollfd pfd = {sock, POLLIN, 0};
+    struct sigaction sa;
+    sigset_t chld, old_mask, wait_mask;
+    int fds[3];
+    ssize_t n;
+
+    if(args == NULL || argv == NULL){
+        fprintf(stderr, "malloc failed. Error: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    // SIGCHLD is blocked but while waiting for a request, so a background command that exits
+    // is reaped right away instead of staying a zombie until the next request
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = zygote_sigchld_handler;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    if(sigaction(SIGCHLD, &sa, NULL) != 0 || sigprocmask(SIG_BLOCK, &chld, &old_mask) != 0){
+        fprintf(stderr, "zygote: SIGCHLD setup failed. Error: %s\n", strerror(errno));
+        exit(1);
+    }
+    wait_mask = old_mask;
+    sigdelset(&wait_mask, SIGCHLD);
+
+    for(;;){
+        while(waitpid(-1, NULL, WNOHANG) > 0);
+
+        if(ppoll(&pfd, 1, NULL, &wait_mask) == -1){
+            if(errno == EINTR)
+                continue;
+            n = -1;
+            break;
+        }
+
+        if((n = zygote_recv(sock, &req, args, fds)) <= 0)
+            break;
+
+        reply.status = 0;
+
+        // a request is exactly its header and argc NUL terminated args
+        if(n - (ssize_t)sizeof(req) != req.len || !valid_args(args, req.len, req.argc)){
+            for(int i = 0; i < 3; i++)
+                close(fds[i]);
+            reply.pid = -1;
+            reply.status = EPROTO;
+            if(send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply))
+                break;
+            continue;
+        }
+
+        char* arg = args;
+        for(int i = 0; i < req.argc; i++){
+            argv[i] = arg;
+            arg += strlen(arg) + 1;
+        }
+        argv[req.argc] = NULL;
+
+        reply.pid = fork();
+
+        // child - the command
+        if(reply.pid == 0){
+            close(sock);
+
+            // the command starts with the signal mask the zygote was forked with
+            if(sigprocmask(SIG_SETMASK, &old_mask, NULL) != 0)
+                exit(1);
+
+            // cancel ignoring SIGINT (only for foreground commands, as run_cmd_fg does)
+            if(!req.background && dfl_sigint())
+                exit(1);
+
+            for(int i = 0; i < 3; i++){
+                if(dup2(fds[i], i) == -1){
+                    fprintf(stderr, "dup2 failed. Error: %s\n", strerror(errno));
+                    exit(1);
+                }
+            }
+
+            if(execvp(argv[0], argv) == -1){
+                fprintf(stderr, "execvp failed. Error: %s\n", strerror(errno));
+                exit(1);
+            }
+        }
+
+        for(int i = 0; i < 3; i++)
+            close(fds[i]);
+
+        if(reply.pid < 0){
+            reply.status = errno;
+        }
+
+        // wait for the foreground command. Any other child reaped meanwhile is a background one
+        else if(!req.background){
+            pid_t pid;
+            while((pid = waitpid(-1, &reply.status, 0)) != reply.pid){
+                if(pid == -1 && errno != EINTR)
+                    break;
+            }
+        }
+
+        if(send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply))
+            break;
+    }
+
+    if(n == -1)
+        fprintf(stderr, "zygote: receiving a request failed. Error: %s\n", strerror(errno));
+
+    _exit(n == -1);
+}
+
+int start_zygote(void){
+    int sv[2];
+
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1){
+        fprintf(stderr, "socketpair failed. Error: %s\n", strerror(errno));
+        return 1;
+    }
+
+    // so that buffered output isn't flushed a second time by the zygote
+    fflush(NULL);
+
+    zygote_pid = fork();
+
+    if(zygote_pid < 0){
+        fprintf(stderr, "fork failed. Error: %s\n", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return 1;
+    }
+
+    // zygote
+    if(zygote_pid == 0){
+        close(sv[0]);
+        zygote_main(sv[1]);
+    }
+
+    close(sv[1]);
+    zygote_sock = sv[0];
+
+    return 0;
+}
+
+void stop_zygote(void){
+    if(zygote_sock == -1)
+        return;
+
+    // the zygote exits on EOF
+    close(zygote_sock);
+    zygote_sock = -1;
+
+    waitpid(zygote_pid, NULL, 0);
+    zygote_pid = -1;
+}
+
+/*
+Runs a command through the zygote and waits for its reply (the exit status, for a foreground one).
+Returns 0 on success, 1 if the zygote failed to fork or its reply was lost, and -1 if the command
+wasn't sent and has to be forked by the shell instead
+ */
+int zygote_spawn(char** arglist, redirections* r, int background){
+    static char args[ZYGOTE_MAX_ARGS_LEN];
+    zygote_request req;
+    zygote_reply reply;
+    int fds[3];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov[2];
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    ssize_t n;
+
+    req.background = background;
+    req.argc = 0;
+    req.len = 0;
+    for(; arglist[req.argc] != NULL; req.argc++){
+        int len = strlen(arglist[req.argc]) + 1;
+        if(req.len + len > ZYGOTE_MAX_ARGS_LEN)
+            return -1;
+        memcpy(args + req.len, arglist[req.argc], len);
+        req.len += len;
+    }
+
+    fds[0] = (r -> in != -1) ? r -> in : STDIN_FILENO;
+    fds[1] = (r -> out != -1) ? r -> out : STDOUT_FILENO;
+    fds[2] = (r -> err != -1) ? r -> err : STDERR_FILENO;
+
+    iov[0].iov_base = &req;
+    iov[0].iov_len = sizeof(req);
+    iov[1].iov_base = args;
+    iov[1].iov_len = req.len;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg -> cmsg_level = SOL_SOCKET;
+    cmsg -> cmsg_type = SCM_RIGHTS;
+    cmsg -> cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    n = sendmsg(zygote_sock, &msg, MSG_NOSIGNAL);
+
+    if(n != (ssize_t)(sizeof(req) + req.len)){
+        fprintf(stderr, "zygote: sendmsg failed, falling back to fork. Error: %s\n", strerror(errno));
+        stop_zygote();
+        return -1;
+    }
+
+    do{
+        n = recv(zygote_sock, &reply, sizeof(reply), 0);
+    }while(n == -1 && errno == EINTR);
+
+    // the zygote may have run the command already, so it isn't run again by the shell
+    if(n != sizeof(reply)){
+        fprintf(stderr, "zygote: no reply, the command may not have run\n");
+        stop_zygote();
+        return 1;
+    }
+
+    if(reply.pid < 0){
+        fprintf(stderr, "fork failed. Error: %s\n", strerror(reply.status));
+        return 1;
+    }
+
+    return 0;
+}
+
+// ---------------------- running commands ---------------------- //
+
+int run_cmd_bg(char** arglist, redirections* r) {
+    if(zygote_sock != -1){
+        int rc = zygote_spawn(arglist, r, 1);
+        if(rc != -1)
+            return rc;
+    }
 
     pid_t pid = fork();
 
@@ -66,6 +618,9 @@ int run_cmd_bg(int count, char** arglist) {
 
     // child
     if(pid == 0){
+        if(apply_redirections(r))
+            exit(1);
+
         if(execvp(arglist[0], arglist) == -1){
             fprintf(stderr, "execvp failed. Error: %s\n", strerror(errno));
             exit(1);
@@ -90,106 +645,350 @@ int run_cmd_bg(int count, char** arglist) {
     return 0;
 }
 
-// Returns the index of the pip char in arglist
-int find_pipe(int count, char** arglist){
-    int ind = 0;
+// Returns the number of stages in a pipe command: the number of | in arglist + 1
+int find_pipes(int count, char** arglist){
+    int num_of_stages = 1;
     for(int i = 0; i < count; i++){
-        if(strcmp(arglist[i], "|") == 0){
-            ind = i;
-            break;
+        if(strcmp(arglist[i], "|") == 0)
+            num_of_stages++;
+    }
+    return num_of_stages;
+}
+
+/*
+Returns fd if it can be fed into a pipe, as cat would copy it. A directory can't (name is the file,
+"-" for stdin, in the error message), so it's closed and -2 is returned
+ */
+int feedable(int fd, char* name){
+    struct stat st;
+
+    if(fstat(fd, &st) == -1){
+        fprintf(stderr, "cat: %s. Error: %s\n", name, strerror(errno));
+        close(fd);
+        return -2;
+    }
+
+    if(S_ISDIR(st.st_mode)){
+        fprintf(stderr, "cat: %s: Is a directory\n", name);
+        close(fd);
+        return -2;
+    }
+
+    return fd;
+}
+
+/*
+Returns the file that a writer stage can be replaced with, -1 if the stage has to be executed, or -2 if
+the file can't be fed (the error is reported, and the next stage gets no input).
+Applies to "< file | cmd" (an empty command with its stdin redirected) and to "cat file | cmd" /
+"cat < file | cmd", whose only job is copying a file into the pipe.
+Takes ownership of the returned descriptor out of r
+ */
+int get_feed_file(char** arglist, redirections* r){
+    struct stat st;
+    int fd;
+
+    if(r -> out != -1 || r -> err != -1)
+        return -1;
+
+    // < file
+    if(arglist[0] == NULL){
+        fd = r -> in;
+        r -> in = -1;
+        return feedable(fd, "-");
+    }
+
+    if(strcmp(arglist[0], "cat") != 0)
+        return -1;
+
+    // cat < file
+    if(arglist[1] == NULL && r -> in != -1){
+        fd = r -> in;
+        r -> in = -1;
+        return feedable(fd, "-");
+    }
+
+    // cat file - anything but a regular file (a device, a fifo) is left to cat itself
+    if(arglist[1] != NULL && arglist[2] == NULL && arglist[1][0] != '-' && r -> in == -1){
+        if(stat(arglist[1], &st) == 0 && !S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))
+            return -1;
+
+        fd = open(arglist[1], O_RDONLY | O_CLOEXEC);
+        if(fd == -1){
+            fprintf(stderr, "cat: %s. Error: %s\n", arglist[1], strerror(errno));
+            return -2;
         }
+
+        return feedable(fd, arglist[1]);
     }
-    return ind;
+
+    return -1;
 }
 
-int run_cmd_pipe(int count, char** arglist) {
-    int pipe_ind = find_pipe(count, arglist);
-    arglist[pipe_ind] = NULL;
+/*
+Copies the whole file src into the pipe's write end.
+splice moves the data inside the kernel, without the extra user space copy a cat process would do.
+Falls back to read/write if src doesn't support splice.
+SIGPIPE is blocked meanwhile, so a reader that exits early ends the copy (EPIPE) instead of the shell
+ */
+int feed_pipe(int src, int pipe_wr){
+    sigset_t pipe_set;
+    sigset_t old_set;
+    struct timespec no_wait = {0, 0};
+    ssize_t n;
+    int rc = 0;
 
-    int fds[2];
-    if (pipe(fds) == -1) {
-        fprintf(stderr, "pipe failed. Error: %s\n", strerror(errno));
-        return 1;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    sigprocmask(SIG_BLOCK, &pipe_set, &old_set);
+
+    // a signal (SIGCHLD of a background command) interrupts a call, not the copy
+    while((n = splice(src, NULL, pipe_wr, NULL, FEED_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0 ||
+          (n == -1 && errno == EINTR));
+
+    if(n == -1 && errno == EINVAL){
+        char* buf = malloc(FEED_CHUNK);
+        if(buf == NULL){
+            fprintf(stderr, "malloc failed. Error: %s\n", strerror(errno));
+            rc = 1;
+        }
+
+        while(buf != NULL && ((n = read(src, buf, FEED_CHUNK)) > 0 || (n == -1 && errno == EINTR))){
+            if(n == -1)
+                continue;
+
+            for(ssize_t off = 0; off < n; ){
+                ssize_t w = write(pipe_wr, buf + off, n - off);
+                if(w == -1){
+                    if(errno == EINTR)
+                        continue;
+                    n = -1;
+                    break;
+                }
+                off += w;
+            }
+            if(n == -1)
+                break;
+        }
+        free(buf);
     }
 
-    pid_t pid_child1 = fork();
+    if(n == -1 && errno != EPIPE){
+        fprintf(stderr, "feeding the pipe failed. Error: %s\n", strerror(errno));
+    }
 
-    if(pid_child1 < 0){
-        fprintf(stderr, "fork failed. Error: %s\n", strerror(errno));
-        close(fds[0]);
-        close(fds[1]);
-        return 1;
+    // discard the SIGPIPE of a reader that exited early
+    sigtimedwait(&pipe_set, NULL, &no_wait);
+    sigprocmask(SIG_SETMASK, &old_set, NULL);
+
+    return rc;
+}
+
+// Sets the pipe's capacity to opts->pipe_size (when requested) and returns 0. Failure isn't fatal
+int set_pipe_size(int fds[2], pipeline_options* opts){
+    if(opts -> pipe_size > 0 && fcntl(fds[1], F_SETPIPE_SZ, opts -> pipe_size) == -1)
+        fprintf(stderr, "F_SETPIPE_SZ failed. Error: %s\n", strerror(errno));
+
+    return 0;
+}
+
+// Pins the calling process (a pipeline stage) to the stage-th cpu it's allowed to run on
+void pin_stage(int stage){
+    int ncpus = CPU_COUNT(&allowed_cpus);
+    int target;
+    cpu_set_t set;
+
+    if(ncpus == 0)
+        return;
+
+    target = stage % ncpus;
+
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+        if(!CPU_ISSET(cpu, &allowed_cpus))
+            continue;
+
+        if(target-- == 0){
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            if(sched_setaffinity(0, sizeof(set), &set) == -1)
+                fprintf(stderr, "sched_setaffinity failed. Error: %s\n", strerror(errno));
+            return;
+        }
     }
+}
 
-    // child 1 - writer
-    if (pid_child1 == 0) {
+/*
+Runs cmd_1 | cmd_2 | ... | cmd_n.
+All the pipes are created up front with O_CLOEXEC, so each stage only dup2's its own two ends,
+and the parent closes its copies once every stage is forked.
+As in sh, a stage whose file can't be opened fails alone: it isn't run, so the stages around it
+see EOF / EPIPE
+ */
+int run_cmd_pipe(int count, char** arglist, pipeline_options* opts) {
+    int num_of_stages = find_pipes(count, arglist);
+    int* starts = malloc(sizeof(int) * num_of_stages);
+    redirections* r = malloc(sizeof(redirections) * num_of_stages);
+    int (*fds)[2] = malloc(sizeof(int[2]) * num_of_stages);
+    pid_t* pids = malloc(sizeof(pid_t) * num_of_stages);
+    char* failed = calloc(num_of_stages, sizeof(char));
+    int feed_fd = -1;
+    int parsed = 0;
+    int piped = 0;
+    int exit_code = 0;
 
-        // cancel ignoring SIGINT
-        if(dfl_sigint())
-            exit(1);
+    if(starts == NULL || r == NULL || fds == NULL || pids == NULL || failed == NULL){
+        fprintf(stderr, "malloc failed. Error: %s\n", strerror(errno));
+        exit_code = 1;
+        goto out;
+    }
 
-        // redirect STDOUT -> fds[1]
-        if(dup2(fds[1], STDOUT_FILENO) == -1 && errno != EINTR){
-            fprintf(stderr, "dup2 failed. Error: %s\n", strerror(errno));
-            exit(1);
+    // split arglist into stages, each one NULL terminated
+    starts[0] = 0;
+    for(int i = 0, stage = 1; i < count; i++){
+        if(strcmp(arglist[i], "|") == 0){
+            arglist[i] = NULL;
+            starts[stage++] = i + 1;
         }
+    }
 
-        close(fds[0]);
-        close(fds[1]);
+    for(; parsed < num_of_stages; parsed++){
+        int end = (parsed == num_of_stages - 1) ? count : starts[parsed + 1] - 1;
+        int rc = parse_redirections(starts[parsed], end, arglist, &r[parsed]);
+        if(rc == -1)
+            goto out;
+        failed[parsed] = (rc == -2);
+    }
 
-        if(execvp(arglist[0], arglist) == -1){
-            fprintf(stderr, "execvp failed. Error: %s\n", strerror(errno));
-            exit(1);
+    // the shell feeds the pipe itself instead of executing the first stage
+    if(!failed[0]){
+        feed_fd = get_feed_file(arglist, &r[0]);
+        if(feed_fd == -2){
+            failed[0] = 1;
+            feed_fd = -1;
         }
     }
 
-    // parent
-    else {
-        pid_t pid_child2 = fork();
+    for(int i = 0; i < num_of_stages; i++){
+        if(!failed[i] && arglist[starts[i]] == NULL && !(i == 0 && feed_fd >= 0)){
+            fprintf(stderr, "syntax error: empty command in pipe\n");
+            goto out;
+        }
+    }
 
-        if(pid_child2 < 0){
+    // fds[i] connects stage i to stage i + 1
+    for(; piped < num_of_stages - 1; piped++){
+        if(pipe2(fds[piped], O_CLOEXEC) == -1){
+            fprintf(stderr, "pipe failed. Error: %s\n", strerror(errno));
+            exit_code = 1;
+            goto out;
+        }
+        set_pipe_size(fds[piped], opts);
+    }
+
+    for(int i = 0; i < num_of_stages; i++){
+        pids[i] = -1;
+        if(failed[i] || (i == 0 && feed_fd >= 0))
+            continue;
+
+        pids[i] = fork();
+
+        if(pids[i] < 0){
             fprintf(stderr, "fork failed. Error: %s\n", strerror(errno));
-            close(fds[0]);
-            close(fds[1]);
-            return 1;
+            exit_code = 1;
+
+            // let the stages that were already started see EOF/EPIPE and finish
+            for(int j = 0; j < piped; j++){
+                close(fds[j][0]);
+                close(fds[j][1]);
+            }
+            piped = 0;
+            for(int j = 0; j < i; j++){
+                if(pids[j] > 0)
+                    waitpid(pids[j], NULL, 0);
+            }
+            goto out;
         }
 
-        // child 2 - reader
-        if(pid_child2 == 0){
+        // child - stage i
+        if(pids[i] == 0){
 
             // cancel ignoring SIGINT
             if(dfl_sigint())
                 exit(1);
 
-            // redirect STDIN -> fds[0]
-            if(dup2(fds[0], STDIN_FILENO) == -1 && errno != EINTR){
+            if(opts -> pin_cpus)
+                pin_stage(i);
+
+            // redirect STDIN -> read end of the previous pipe
+            if(i > 0 && dup2(fds[i - 1][0], STDIN_FILENO) == -1){
+                fprintf(stderr, "dup2 failed. Error: %s\n", strerror(errno));
+                exit(1);
+            }
+
+            // redirect STDOUT -> write end of the next pipe
+            if(i < num_of_stages - 1 && dup2(fds[i][1], STDOUT_FILENO) == -1){
                 fprintf(stderr, "dup2 failed. Error: %s\n", strerror(errno));
                 exit(1);
             }
 
-            close(fds[1]);
-            close(fds[0]);
+            if(apply_redirections(&r[i]))
+                exit(1);
 
-            if(execvp(arglist[pipe_ind + 1], arglist + pipe_ind + 1) == -1){
+            if(execvp(arglist[starts[i]], arglist + starts[i]) == -1){
                 fprintf(stderr, "execvp failed. Error: %s\n", strerror(errno));
                 exit(1);
             }
         }
+    }
 
-        // parent
-        else{
-            close(fds[0]);
-            close(fds[1]);
+    // parent
+    for(int i = 0; i < piped; i++){
+        close(fds[i][0]);
+        if(!(i == 0 && feed_fd >= 0))
+            close(fds[i][1]);
+    }
+    for(; parsed > 0; parsed--)
+        close_redirections(&r[parsed - 1]);
 
-            waitpid(pid_child1, NULL, 0);
-            waitpid(pid_child2, NULL, 0);
-        }
+    if(feed_fd >= 0){
+        feed_pipe(feed_fd, fds[0][1]);
+        close(fds[0][1]);
+        close(feed_fd);
+        feed_fd = -1;
     }
+    piped = 0;
 
-    return 0;
+    for(int i = 0; i < num_of_stages; i++){
+        if(pids[i] > 0)
+            waitpid(pids[i], NULL, 0);
+    }
+
+out:
+    for(int i = 0; i < piped; i++){
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+    for(; parsed > 0; parsed--)
+        close_redirections(&r[parsed - 1]);
+    if(feed_fd >= 0)
+        close(feed_fd);
+
+    free(starts);
+    free(r);
+    free(fds);
+    free(pids);
+    free(failed);
+
+    return exit_code;
 }
 
-int run_cmd_fg(char** arglist){
+int run_cmd_fg(char** arglist, redirections* r){
+    if(zygote_sock != -1){
+        int rc = zygote_spawn(arglist, r, 0);
+        if(rc != -1)
+            return rc;
+    }
+
     pid_t pid = fork();
 
     if(pid < 0){
@@ -204,6 +1003,9 @@ int run_cmd_fg(char** arglist){
         if(dfl_sigint())
             exit(1);
 
+        if(apply_redirections(r))
+            exit(1);
+
         if(execvp(arglist[0], arglist) == -1){
             fprintf(stderr, "execvp failed. Error: %s\n", strerror(errno));
             exit(1);
@@ -231,20 +1033,43 @@ int get_state(int count, char** arglist){
     return 0;
 }
 
-int process_arglist(int count, char** arglist){
+int run_arglist(int count, char** arglist){
     int exit_code;
-    int state = get_state(count, arglist);
+    int state;
+    redirections r;
+    pipeline_options opts = default_pipeline_options;
+    int num_of_options = parse_pipeline_options(count, arglist, &opts);
 
-    if(state == BG){
-        exit_code = run_cmd_bg(count, arglist);
-    }
+    arglist += num_of_options;
+    count -= num_of_options;
+    if(count == 0)
+        return 1;
 
-    else if(state == PIPE) {
-        exit_code = run_cmd_pipe(count, arglist);
+    state = get_state(count, arglist);
+
+    if(state == PIPE) {
+        exit_code = run_cmd_pipe(count, arglist, &opts);
     }
 
     else {
-        exit_code = run_cmd_fg(arglist);
+        if(state == BG)
+            count--;
+
+        // a bad redirection fails the command, not the shell
+        if(parse_redirections(0, count, arglist, &r) < 0)
+            return 1;
+
+        if(arglist[0] == NULL){
+            close_redirections(&r);
+            return 1;
+        }
+
+        if(state == BG)
+            exit_code = run_cmd_bg(arglist, &r);
+        else
+            exit_code = run_cmd_fg(arglist, &r);
+
+        close_redirections(&r);
     }
 
     if(exit_code != 0)
@@ -253,4 +1078,382 @@ int process_arglist(int count, char** arglist){
         return 1;
 }
 
-// gcc -O3 -D_POSIX_C-SOURCE=200809 -Wall -std=c11 shell.c myshell.c
\ No newline at end of file
+// ---------------------- command substitution ---------------------- //
+
+/*
+A $(cmd) in the command line. shell.c splits the line on whitespace, so cmd's words are the
+arglist words between the $( and the ). Nested substitutions aren't supported, and the text
+after the ) is kept as is.
+cmd may be a pipeline and may have redirections.
+The output replaces the substitution and is split into words, as an unquoted $(cmd) in sh;
+text right before the $( or after the ) is glued to the first/last of these words
+ */
+typedef struct substitution{
+    char* prefix;       // text before the $(
+    int prefix_len;
+    char* suffix;       // text after the )
+    char** argv;        // cmd's words, NULL terminated
+    pid_t pid;
+    int fd;             // read end of the pipe cmd's stdout is captured from, -1 once drained
+    char* out;          // the captured output
+    size_t len;
+    size_t cap;
+}substitution;
+
+// the arglist of a command line after substitution, and what its words are allocated in
+typedef struct expansion{
+    int count;
+    char** arglist;
+    int num_of_subs;
+    substitution* subs;
+    int* sub_at;        // for every word of the original arglist: its substitution or -1
+}expansion;
+
+// Returns 1 if any word of arglist has a $( in it
+int has_substitutions(int count, char** arglist){
+    for(int i = 0; i < count; i++){
+        if(strstr(arglist[i], "$(") != NULL)
+            return 1;
+    }
+    return 0;
+}
+
+void free_expansion(expansion* e){
+    for(int i = 0; i < e -> num_of_subs; i++){
+        substitution* sub = &e -> subs[i];
+        if(sub -> argv != NULL){
+            for(int j = 0; sub -> argv[j] != NULL; j++)
+                free(sub -> argv[j]);
+        }
+        free(sub -> argv);
+        free(sub -> out);
+        if(sub -> fd != -1)
+            close(sub -> fd);
+    }
+    free(e -> subs);
+    free(e -> sub_at);
+    free(e -> arglist);
+}
+
+// Appends a word to cmd's argv of the substitution. Returns 1 on failure
+int add_subst_word(substitution* sub, int* argc, char* word, int len){
+    if(len == 0)
+        return 0;
+
+    char** argv = realloc(sub -> argv, sizeof(char*) * (*argc + 2));
+    if(argv == NULL)
+        return 1;
+    sub -> argv = argv;
+
+    argv[*argc] = strndup(word, len);
+    if(argv[*argc] == NULL)
+        return 1;
+    argv[++(*argc)] = NULL;
+
+    return 0;
+}
+
+/*
+Finds the substitutions of arglist and fills e -> subs and e -> sub_at.
+Returns 0 on success, -1 on a syntax error and 1 on failure
+ */
+int find_substitutions(int count, char** arglist, expansion* e){
+    e -> subs = malloc(sizeof(substitution) * count);
+    e -> sub_at = malloc(sizeof(int) * count);
+    if(e -> subs == NULL || e -> sub_at == NULL)
+        return 1;
+
+    for(int i = 0; i < count; i++){
+        char* open = strstr(arglist[i], "$(");
+        e -> sub_at[i] = -1;
+        if(open == NULL)
+            continue;
+
+        substitution* sub = &e -> subs[e -> num_of_subs++];
+        int argc = 0;
+        char* word = open + 2;
+        char* close;
+
+        memset(sub, 0, sizeof(*sub));
+        sub -> fd = -1;
+        sub -> pid = -1;
+        sub -> prefix = arglist[i];
+        sub -> prefix_len = open - arglist[i];
+
+        // the words of cmd, up to the word with the )
+        while((close = strchr(word, ')')) == NULL){
+            if(add_subst_word(sub, &argc, word, strlen(word)))
+                return 1;
+
+            e -> sub_at[i] = e -> num_of_subs - 1;
+            if(++i == count){
+                fprintf(stderr, "syntax error: missing ) of $(\n");
+                return -1;
+            }
+            word = arglist[i];
+        }
+
+        if(add_subst_word(sub, &argc, word, close - word))
+            return 1;
+
+        e -> sub_at[i] = e -> num_of_subs - 1;
+        sub -> suffix = close + 1;
+
+        if(argc == 0){
+            fprintf(stderr, "syntax error: empty $()\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Forks cmd of the substitution with its stdout going to a non blocking pipe. Returns 1 on failure
+int start_substitution(substitution* sub){
+    int fds[2];
+
+    if(pipe2(fds, O_CLOEXEC) == -1){
+        fprintf(stderr, "pipe failed. Error: %s\n", strerror(errno));
+        return 1;
+    }
+
+    sub -> pid = fork();
+
+    if(sub -> pid < 0){
+        fprintf(stderr, "fork failed. Error: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+
+    // child
+    if(sub -> pid == 0){
+
+        // cancel ignoring SIGINT
+        if(dfl_sigint())
+            exit(1);
+
+        if(dup2(fds[1], STDOUT_FILENO) == -1){
+            fprintf(stderr, "dup2 failed. Error: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        // a pipeline or redirections in cmd: run it the way a command line is run
+        int argc = 0;
+        int simple = 1;
+        for(; sub -> argv[argc] != NULL; argc++){
+            if(strcmp(sub -> argv[argc], "|") == 0 || is_redirection(sub -> argv[argc]))
+                simple = 0;
+        }
+
+        if(!simple){
+            // the zygote's socket belongs to the shell
+            zygote_sock = -1;
+            exit(run_arglist(argc, sub -> argv) ? 0 : 1);
+        }
+
+        if(execvp(sub -> argv[0], sub -> argv) == -1){
+            fprintf(stderr, "execvp failed. Error: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+
+    close(fds[1]);
+    sub -> fd = fds[0];
+    fcntl(sub -> fd, F_SETFL, O_NONBLOCK);
+
+    return 0;
+}
+
+// Reads whatever is available from the substitution's pipe. Returns 1 on failure
+int read_substitution(substitution* sub){
+    ssize_t n;
+
+    do{
+        if(sub -> cap - sub -> len < SUBST_CHUNK){
+            size_t cap = sub -> cap ? sub -> cap * 2 : SUBST_CHUNK;
+            char* out = realloc(sub -> out, cap);
+            if(out == NULL){
+                fprintf(stderr, "realloc failed. Error: %s\n", strerror(errno));
+                return 1;
+            }
+            sub -> out = out;
+            sub -> cap = cap;
+        }
+
+        n = read(sub -> fd, sub -> out + sub -> len, sub -> cap - sub -> len);
+        if(n > 0)
+            sub -> len += n;
+    }while(n > 0);
+
+    if(n == 0){
+        close(sub -> fd);
+        sub -> fd = -1;
+    }
+    else if(errno != EAGAIN && errno != EINTR){
+        fprintf(stderr, "read failed. Error: %s\n", strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+Runs all the substitutions concurrently and captures their outputs: they're all forked first,
+and then their pipes are drained together with poll, so a command line with several
+substitutions takes about as long as the slowest one. Returns 1 on failure
+ */
+int run_substitutions(expansion* e){
+    struct pollfd* pfds = malloc(sizeof(struct pollfd) * e -> num_of_subs);
+    int* owners = malloc(sizeof(int) * e -> num_of_subs);
+    int rc = 0;
+
+    if(pfds == NULL || owners == NULL){
+        fprintf(stderr, "malloc failed. Error: %s\n", strerror(errno));
+        rc = 1;
+    }
+
+    for(int i = 0; rc == 0 && i < e -> num_of_subs; i++)
+        rc = start_substitution(&e -> subs[i]);
+
+    while(rc == 0){
+        int n = 0;
+        for(int i = 0; i < e -> num_of_subs; i++){
+            if(e -> subs[i].fd == -1)
+                continue;
+            pfds[n].fd = e -> subs[i].fd;
+            pfds[n].events = POLLIN;
+            owners[n++] = i;
+        }
+
+        if(n == 0)
+            break;
+
+        if(poll(pfds, n, -1) == -1){
+            if(errno == EINTR)
+                continue;
+            fprintf(stderr, "poll failed. Error: %s\n", strerror(errno));
+            rc = 1;
+            break;
+        }
+
+        for(int i = 0; rc == 0 && i < n; i++){
+            if(pfds[i].revents != 0)
+                rc = read_substitution(&e -> subs[owners[i]]);
+        }
+    }
+
+    // on failure, the commands that are still running get EPIPE once their pipes are closed
+    for(int i = 0; i < e -> num_of_subs; i++){
+        if(e -> subs[i].fd != -1){
+            close(e -> subs[i].fd);
+            e -> subs[i].fd = -1;
+        }
+        if(e -> subs[i].pid > 0)
+            waitpid(e -> subs[i].pid, NULL, 0);
+    }
+
+    free(pfds);
+    free(owners);
+    return rc;
+}
+
+// Appends a word to the expanded arglist. Returns 1 on failure
+int add_word(expansion* e, char* word){
+    char** arglist = realloc(e -> arglist, sizeof(char*) * (e -> count + 2));
+    if(arglist == NULL){
+        fprintf(stderr, "realloc failed. Error: %s\n", strerror(errno));
+        return 1;
+    }
+
+    e -> arglist = arglist;
+    e -> arglist[e -> count++] = word;
+    e -> arglist[e -> count] = NULL;
+
+    return 0;
+}
+
+/*
+Replaces the substitution with its words: prefix + output + suffix is split on whitespace
+in place (the prefix and suffix have none, so they end up glued to the first and last words)
+Returns 1 on failure
+ */
+int add_subst_words(expansion* e, substitution* sub){
+    size_t suffix_len = strlen(sub -> suffix);
+    char* text = malloc(sub -> prefix_len + sub -> len + suffix_len + 1);
+    char* save;
+
+    if(text == NULL){
+        fprintf(stderr, "malloc failed. Error: %s\n", strerror(errno));
+        return 1;
+    }
+
+    // trailing newlines are dropped, as in sh
+    while(sub -> len > 0 && sub -> out[sub -> len - 1] == '\n')
+        sub -> len--;
+
+    memcpy(text, sub -> prefix, sub -> prefix_len);
+    if(sub -> len > 0)
+        memcpy(text + sub -> prefix_len, sub -> out, sub -> len);
+    memcpy(text + sub -> prefix_len + sub -> len, sub -> suffix, suffix_len + 1);
+
+    // the words are allocated in the output buffer from now on
+    free(sub -> out);
+    sub -> out = text;
+
+    for(char* word = strtok_r(text, " \t\n", &save); word != NULL; word = strtok_r(NULL, " \t\n", &save)){
+        if(add_word(e, word))
+            return 1;
+    }
+
+    return 0;
+}
+
+/*
+Expands the $(cmd)s of arglist into e -> arglist.
+Returns 0 on success, -1 if the command fails (syntax error) and 1 on failure
+ */
+int expand_substitutions(int count, char** arglist, expansion* e){
+    int rc;
+
+    memset(e, 0, sizeof(*e));
+
+    rc = find_substitutions(count, arglist, e);
+    if(rc == 1)
+        fprintf(stderr, "malloc failed. Error: %s\n", strerror(errno));
+    if(rc == 0)
+        rc = run_substitutions(e);
+
+    for(int i = 0; rc == 0 && i < count; i++){
+        int sub = e -> sub_at[i];
+
+        if(sub == -1)
+            rc = add_word(e, arglist[i]);
+
+        // a substitution that spans several words is replaced once
+        else if(i == 0 || e -> sub_at[i - 1] != sub)
+            rc = add_subst_words(e, &e -> subs[sub]);
+    }
+
+    return rc;
+}
+
+int process_arglist(int count, char** arglist){
+    expansion e;
+    int rc;
+
+    if(!has_substitutions(count, arglist))
+        return run_arglist(count, arglist);
+
+    rc = expand_substitutions(count, arglist, &e);
+
+    if(rc == 0)
+        rc = (e.count == 0) ? 1 : run_arglist(e.count, e.arglist);
+    else
+        rc = (rc == -1) ? 1 : 0;
+
+    free_expansion(&e);
+    return rc;
+}
+
+// gcc -O3 -D_POSIX_C-SOURCE=200809 -Wall -std=c11 shell.c myshell.c
@@ -0,0 +1,369 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/*
+Benchmark driver for myshell.c. Like shell.c it provides main() and feeds process_arglist,
+but with synthetic command lines instead of stdin, timing each one.
+The shell workload drives a built shell binary (shell.c + myshell.c) through its stdin instead,
+so line reading and parsing are measured too.
+Run it before and after any change to the fork, reaping or parsing paths.
+ */
+
+int process_arglist(int count, char** arglist);
+int prepare(void);
+int finalize(void);
+
+#define MAX_LINE 4096
+
+long long now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+Splits line into words the way shell.c does and runs it through process_arglist.
+Returns the elapsed time in ns, or -1 if process_arglist asked the shell to exit
+ */
+long long run_line(const char* line){
+    char buf[MAX_LINE];
+    char* arglist[MAX_LINE / 2 + 1];
+    int count = 0;
+    long long start;
+    int rc;
+
+    strncpy(buf, line, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    arglist[0] = strtok(buf, " \t\n");
+    while(arglist[count] != NULL)
+        arglist[++count] = strtok(NULL, " \t\n");
+
+    start = now_ns();
+    rc = process_arglist(count, arglist);
+
+    return rc ? now_ns() - start : -1;
+}
+
+// ---------------------- statistics ---------------------- //
+
+// Returns the p-th percentile of the n sorted samples
+long long percentile(long long* sorted, int n, double p){
+    int i = (int)(p / 100 * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+int cmp_ll(const void* a, const void* b){
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+// Runs line n times. Returns the n latencies (sorted) and the total elapsed time in total_ns
+long long* run_lines(char* line, int n, long long* total_ns){
+    long long* samples = malloc(sizeof(long long) * n);
+    long long start = now_ns();
+
+    if(samples == NULL){
+        fprintf(stderr, "Error: malloc() failed.\n");
+        exit(1);
+    }
+
+    for(int i = 0; i < n; i++){
+        samples[i] = run_line(line);
+        if(samples[i] < 0){
+            fprintf(stderr, "Error: process_arglist failed on: %s\n", line);
+            exit(1);
+        }
+    }
+
+    *total_ns = now_ns() - start;
+    qsort(samples, n, sizeof(long long), cmp_ll);
+
+    return samples;
+}
+
+void print_latency(char* title, long long* sorted, int n, long long total_ns){
+    printf("  %-12s %9.0f cmd/s  p50 %8.1f us  p90 %8.1f us  p99 %8.1f us  max %8.1f us\n",
+           title, n * 1e9 / total_ns,
+           percentile(sorted, n, 50) / 1000.0, percentile(sorted, n, 90) / 1000.0,
+           percentile(sorted, n, 99) / 1000.0, sorted[n - 1] / 1000.0);
+}
+
+// ---------------------- workloads ---------------------- //
+
+// n foreground "true" commands
+void fg_workload(int n){
+    long long total_ns;
+    long long* samples = run_lines("true", n, &total_ns);
+
+    printf("foreground (%d runs of true)\n", n);
+    print_latency("fg", samples, n, total_ns);
+
+    free(samples);
+}
+
+/*
+n background "true &" commands. The latency is the launch only; the drain time is how long
+it takes until the jobs still running after the last launch are all reaped
+ */
+void bg_workload(int n){
+    long long total_ns;
+    long long* samples = run_lines("true &", n, &total_ns);
+    long long start = now_ns();
+
+    printf("background (%d runs of true &)\n", n);
+    print_latency("bg launch", samples, n, total_ns);
+
+    // with the zygote, the jobs are its children and not ours
+    if(getenv("ZYGOTE") == NULL || atoi(getenv("ZYGOTE")) == 0){
+        while(waitpid(-1, NULL, 0) > 0 || errno == EINTR);
+        printf("  %-12s %9.1f ms\n", "drain", (now_ns() - start) / 1e6);
+    }
+
+    free(samples);
+}
+
+/*
+Moves bytes from /dev/zero through a pipeline of the given number of stages:
+head | cat | ... | wc -c > /dev/null
+Returns the best throughput over reps runs in GB/s
+ */
+double pipeline_throughput(int stages, long long bytes, char* options, int reps){
+    char line[MAX_LINE];
+    int len;
+    double best = 0;
+
+    len = snprintf(line, sizeof(line), "%s head -c %lld /dev/zero", options, bytes);
+    for(int i = 2; i < stages; i++)
+        len += snprintf(line + len, sizeof(line) - len, " | cat");
+    snprintf(line + len, sizeof(line) - len, " | wc -c > /dev/null");
+
+    for(int i = 0; i < reps; i++){
+        long long elapsed = run_line(line);
+        if(elapsed < 0){
+            fprintf(stderr, "Error: process_arglist failed on: %s\n", line);
+            exit(1);
+        }
+
+        double gbps = (double)bytes / elapsed;
+        if(gbps > best)
+            best = gbps;
+    }
+
+    return best;
+}
+
+// Throughput of 2, 4 and 8 stage pipelines
+void pipeline_workload(long long bytes, char* options, int reps){
+    int stages[] = {2, 4, 8};
+
+    printf("pipeline throughput (%lld bytes, best of %d,%s)\n", bytes, reps,
+           options[0] ? options : " default options");
+    for(int i = 0; i < (int)(sizeof(stages) / sizeof(stages[0])); i++)
+        printf("  %d stages: %6.2f GB/s\n", stages[i], pipeline_throughput(stages[i], bytes, options, reps));
+}
+
+/*
+Launch latency of a foreground "true" from a shell that holds ballast_mb of touched memory,
+forked directly by the shell vs. by the zygote (which was started before the ballast grew).
+Runs its own prepare/finalize pairs
+ */
+void launch_workload(int n, long long ballast_mb){
+    size_t ballast_len = (size_t)ballast_mb << 20;
+    long long total_ns;
+    long long* samples;
+    char* ballast;
+
+    printf("launch latency (%d runs of true, %lld MB shell)\n", n, ballast_mb);
+
+    setenv("ZYGOTE", "1", 1);
+    if(prepare() != 0)
+        exit(1);
+
+    // small pages, like a long lived heap, so fork has a page table entry to copy per 4K
+    ballast = mmap(NULL, ballast_len + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ballast == MAP_FAILED){
+        fprintf(stderr, "Error: mmap() failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    madvise(ballast, ballast_len + 1, MADV_NOHUGEPAGE);
+    memset(ballast, 1, ballast_len);
+
+    samples = run_lines("true", n, &total_ns);
+    print_latency("zygote", samples, n, total_ns);
+    free(samples);
+
+    if(finalize() != 0)
+        exit(1);
+
+    unsetenv("ZYGOTE");
+    if(prepare() != 0)
+        exit(1);
+
+    samples = run_lines("true", n, &total_ns);
+    print_latency("direct fork", samples, n, total_ns);
+    free(samples);
+
+    if(finalize() != 0)
+        exit(1);
+
+    munmap(ballast, ballast_len + 1);
+}
+
+/*
+End to end: writes n "true" lines to the stdin of the shell binary at path and waits for it
+to exit, so this includes shell.c's reading and tokenizing
+ */
+void shell_workload(char* path, int n){
+    int fds[2];
+    long long start;
+    pid_t pid;
+    FILE* in;
+
+    if(pipe(fds) == -1){
+        fprintf(stderr, "Error: pipe() failed: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    start = now_ns();
+    pid = fork();
+
+    if(pid < 0){
+        fprintf(stderr, "Error: fork() failed: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    if(pid == 0){
+        dup2(fds[0], STDIN_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl(path, path, (char*)NULL);
+        fprintf(stderr, "Error: execl() failed: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    close(fds[0]);
+    in = fdopen(fds[1], "w");
+    for(int i = 0; i < n && in != NULL; i++)
+        fputs("true\n", in);
+    if(in != NULL)
+        fclose(in);
+
+    waitpid(pid, NULL, 0);
+
+    printf("end to end (%d runs of true through %s)\n", n, path);
+    printf("  %-12s %9.0f cmd/s\n", "shell", n * 1e9 / (now_ns() - start));
+}
+
+void usage(char* prog){
+    fprintf(stderr, "usage: %s <workload> [options]\n"
+                    "workloads:\n"
+                    "  fg        foreground true: commands per second and latency percentiles\n"
+                    "  bg        background true &: launch rate, latency percentiles and reaping time\n"
+                    "  pipeline  GB/s through 2, 4 and 8 stage head | cat ... | wc -c pipelines\n"
+                    "  launch    zygote vs. direct fork latency from a large shell\n"
+                    "  shell     commands per second through a shell binary's stdin (-s)\n"
+                    "  all       fg, bg and pipeline\n"
+                    "options:\n"
+                    "  -n  commands per workload (default 2000)\n"
+                    "  -b  bytes moved through each pipeline (default 1G)\n"
+                    "  -r  runs per pipeline, the best one is reported (default 3)\n"
+                    "  -p  PIPESZ of the pipelines\n"
+                    "  -c  pin the pipeline stages to distinct cpus (PIPECPU=1)\n"
+                    "  -m  memory the shell holds for launch, in MB (default 1024)\n"
+                    "  -s  path of the shell binary for shell (default ./myshell)\n", prog);
+    exit(1);
+}
+
+/**
+ * argv[1] = workload, followed by its options
+ */
+int main(int argc, char** argv){
+    long long bytes = 1LL << 30;
+    long long ballast_mb = 1024;
+    int reps = 3;
+    int runs = 2000;
+    char options[256] = "";
+    char* shell_path = "./myshell";
+    char* workload;
+    int opt;
+
+    if(argc < 2)
+        usage(argv[0]);
+
+    workload = argv[1];
+    optind = 2;
+    while((opt = getopt(argc, argv, "n:b:r:p:cm:s:")) != -1){
+        switch(opt){
+            case 'n':
+                runs = atoi(optarg);
+                break;
+            case 'b':
+                bytes = atoll(optarg);
+                break;
+            case 'r':
+                reps = atoi(optarg);
+                break;
+            case 'p':
+                snprintf(options + strlen(options), sizeof(options) - strlen(options), " PIPESZ=%s", optarg);
+                break;
+            case 'c':
+                snprintf(options + strlen(options), sizeof(options) - strlen(options), " PIPECPU=1");
+                break;
+            case 'm':
+                ballast_mb = atoll(optarg);
+                break;
+            case 's':
+                shell_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if(bytes <= 0 || reps <= 0 || runs <= 0 || ballast_mb < 0)
+        usage(argv[0]);
+
+    if(strcmp(workload, "launch") == 0){
+        launch_workload(runs, ballast_mb);
+        return 0;
+    }
+
+    if(strcmp(workload, "shell") == 0){
+        shell_workload(shell_path, runs);
+        return 0;
+    }
+
+    if(strcmp(workload, "fg") != 0 && strcmp(workload, "bg") != 0 &&
+       strcmp(workload, "pipeline") != 0 && strcmp(workload, "all") != 0)
+        usage(argv[0]);
+
+    if(prepare() != 0)
+        exit(1);
+
+    if(strcmp(workload, "fg") == 0 || strcmp(workload, "all") == 0)
+        fg_workload(runs);
+
+    if(strcmp(workload, "bg") == 0 || strcmp(workload, "all") == 0)
+        bg_workload(runs);
+
+    if(strcmp(workload, "pipeline") == 0 || strcmp(workload, "all") == 0)
+        pipeline_workload(bytes, options, reps);
+
+    if(finalize() != 0)
+        exit(1);
+
+    return 0;
+}
+
+// gcc -O3 -D_POSIX_C-SOURCE=200809 -Wall -std=c11 shell_bench.c myshell.c -o shell_bench
+// gcc -O3 -D_POSIX_C-SOURCE=200809 -Wall -std=c11 shell.c myshell.c -o myshell
@@ -0,0 +1,781 @@
+#include "channel_store.h"
+
+#ifdef __KERNEL__
+#include <linux/vmalloc.h>
+#include <linux/overflow.h>
+#include <linux/poll.h>
+#include <linux/jiffies.h>
+#include <linux/sched.h>
+#include <linux/topology.h>
+#endif
+
+/**
+ * The channel store of a message slot - everything about channels that doesn't depend on files.
+ * message_slot_main.c (the device) keeps a store per minor, store_bench.c and store_fuzz.c use it
+ * from userspace threads (see channel_store_user.h).
+ *
+ * - A message is never modified once it's published on a channel. A write builds a new message
+ *   and swaps it in under the channel's lock, so writers serialize per channel only.
+ * - Readers take no lock: under rcu_read_lock they take a reference to the channel's current
+ *   message, and copy it out after rcu_read_unlock. A message is freed (after an RCU grace period)
+ *   when the channel and all the readers copying it dropped their references.
+ * - Nodes are found under rcu_read_lock too, and freed an RCU grace period after their last reference.
+ */
+
+unsigned long max_slot_bytes;
+unsigned long max_total_bytes;
+
+atomic_long_t total_bytes;
+
+bool numa_place;
+bool align_nodes;
+
+// sizes of the message caches' objects (header included). Larger messages are kvmalloc-ed
+static const unsigned int size_classes[] = {64, 128, 256, 512, 1024, 2048, 4096};
+static const char* size_class_names[] = {"message_slot_64", "message_slot_128", "message_slot_256",
+                                         "message_slot_512", "message_slot_1k", "message_slot_2k",
+                                         "message_slot_4k"};
+
+#define NUM_SIZE_CLASSES ARRAY_SIZE(size_classes)
+
+static struct kmem_cache* message_caches[NUM_SIZE_CLASSES];
+
+static struct kmem_cache* node_cache;
+
+// the bytes a node holds - what the slab hands out, a whole cache line or more with align_nodes
+static size_t node_size(void){
+    return kmem_cache_size(node_cache);
+}
+
+//================== MEMORY =====================================
+
+/**
+ * Counts bytes more as held by the store
+ * @return 0 on success, -EDQUOT if that would pass max_slot_bytes or max_total_bytes (then nothing is counted)
+ */
+int charge(channel_store* s, size_t bytes){
+    unsigned long   store_cap = READ_ONCE(max_slot_bytes);
+    unsigned long   total_cap = READ_ONCE(max_total_bytes);
+    unsigned long   store_bytes = atomic_long_add_return(bytes, &s -> bytes);
+    unsigned long   all_bytes = atomic_long_add_return(bytes, &total_bytes);
+
+    if((store_cap != 0 && store_bytes > store_cap) || (total_cap != 0 && all_bytes > total_cap)){
+        atomic_long_sub(bytes, &s -> bytes);
+        atomic_long_sub(bytes, &total_bytes);
+        return -EDQUOT;
+    }
+
+    return 0;
+}
+
+void uncharge(channel_store* s, size_t bytes){
+    atomic_long_sub(bytes, &s -> bytes);
+    atomic_long_sub(bytes, &total_bytes);
+}
+
+//================== MESSAGES ===================================
+
+/**
+ * Returns the NUMA node the channel's messages are allocated on: with numa_place the node of the
+ * channel's first writer, which the first call claims, OW NUMA_NO_NODE (wherever the writer runs)
+ */
+static int channel_nid(node* n){
+    int   nid;
+
+    if(!READ_ONCE(numa_place))
+        return NUMA_NO_NODE;
+
+    nid = READ_ONCE(n -> nid);
+
+    if(nid == NUMA_NO_NODE){
+        cmpxchg(&n -> nid, NUMA_NO_NODE, numa_node_id());
+        nid = READ_ONCE(n -> nid);
+    }
+
+    return nid;
+}
+
+// Allocates an unpublished message that can hold bytes bytes, on NUMA node nid (NUMA_NO_NODE - any)
+static message* alloc_message(size_t bytes, int nid){
+    size_t   size = offsetof(message, data) + bytes;
+    message* msg;
+    int      i;
+
+    for(i = 0; i < NUM_SIZE_CLASSES; i++){
+        if(size <= size_classes[i]){
+            msg = kmem_cache_alloc_node(message_caches[i], GFP_KERNEL, nid);
+            if(msg != NULL)
+                msg -> size_class = i;
+            return msg;
+        }
+    }
+
+    msg = kvmalloc_node(size, GFP_KERNEL, nid);
+    if(msg != NULL)
+        msg -> size_class = LARGE_MESSAGE;
+
+    return msg;
+}
+
+static void free_message(message* msg){
+    if(msg -> size_class == LARGE_MESSAGE)
+        kvfree(msg);
+    else
+        kmem_cache_free(message_caches[msg -> size_class], msg);
+}
+
+static void free_message_rcu(struct rcu_head* head){
+    free_message(container_of(head, message, rcu));
+}
+
+/**
+ * Returns the current message of the channel with a reference the caller has to put,
+ * or NULL if no message has been set on the channel. Doesn't take any lock
+ */
+message* get_message(node* n){
+    message* msg;
+
+    rcu_read_lock();
+
+    // a writer may drop the last reference to msg right after we found it. Then it has
+    // already published a new message, which the next round finds
+    do{
+        msg = rcu_dereference(n -> msg);
+    }while(msg != NULL && !refcount_inc_not_zero(&msg -> refs));
+
+    rcu_read_unlock();
+
+    return msg;
+}
+
+void put_message(message* msg){
+    if(refcount_dec_and_test(&msg -> refs))
+        call_rcu(&msg -> rcu, free_message_rcu);
+}
+
+// Returns the bytes a message holds
+static size_t message_size(message* msg){
+    if(msg -> size_class == LARGE_MESSAGE)
+        return offsetof(message, data) + msg -> bytes;
+
+    return size_classes[msg -> size_class];
+}
+
+/**
+ * Allocates an unpublished message of bytes bytes for the channel, counted as held by its store,
+ * with a reference for the caller
+ * @return the message on success. OW, ERR_PTR of the error value.
+ */
+message* new_message(node* n, size_t bytes){
+    channel_store*   s = n -> store;
+    message*         msg = alloc_message(bytes, channel_nid(n));
+
+    if(msg == NULL)
+        return ERR_PTR(-ENOMEM);
+
+    msg -> bytes = bytes;
+    refcount_set(&msg -> refs, 1);
+
+    if(charge(s, message_size(msg))){
+        free_message(msg);
+        return ERR_PTR(-EDQUOT);
+    }
+
+    return msg;
+}
+
+// Puts a message a channel of the store held (or one that was never posted) and stops counting it
+void drop_message(channel_store* s, message* msg){
+    uncharge(s, message_size(msg));
+    put_message(msg);
+}
+
+/**
+ * Publishes msg as the channel's message (NULL for none), which takes over the caller's reference.
+ * Called with n -> lock held
+ * @return the message it replaced, which the caller drops once the lock is released
+ */
+static message* publish_message(node* n, message* msg){
+    message* old = rcu_dereference_protected(n -> msg, lockdep_is_held(&n -> lock));
+
+    if(msg != NULL){
+        msg -> seq = n -> seq + 1;
+        WRITE_ONCE(n -> seq, msg -> seq);
+    }
+
+    rcu_assign_pointer(n -> msg, msg);
+
+    return old;
+}
+
+//================== QUEUES =====================================
+
+// Returns whether the channel is in queue mode, and if so its count of queued messages and capacity
+bool queue_state(node* n, unsigned int* count, unsigned int* capacity){
+    msg_queue* q;
+
+    spin_lock(&n -> lock);
+    q = n -> queue;
+    if(q != NULL){
+        *count = q -> count;
+        *capacity = q -> capacity;
+    }
+    spin_unlock(&n -> lock);
+
+    return q != NULL;
+}
+
+/**
+ * Adds msg to the channel by its mode, which it checks under the same lock hold, so a concurrent
+ * MSG_SLOT_QUEUE can't slip in between: in queue mode appends it to the queue, OW publishes it as
+ * the last message. The channel takes over the caller's reference
+ * @return 0 on success, -EAGAIN if the queue is full, -EIDRM if the channel was deleted
+ *         (on failure the caller keeps its reference)
+ */
+static int store_message(node* n, message* msg){
+    msg_queue*  q;
+    message*    old = NULL;
+
+    spin_lock(&n -> lock);
+
+    if(n -> dead){
+        spin_unlock(&n -> lock);
+        return -EIDRM;
+    }
+
+    q = n -> queue;
+
+    if(q == NULL){
+        old = publish_message(n, msg);
+    }
+    else if(q -> count == q -> capacity){
+        spin_unlock(&n -> lock);
+        return -EAGAIN;
+    }
+    else{
+        msg -> seq = n -> seq + 1;
+        WRITE_ONCE(n -> seq, msg -> seq);
+        q -> msgs[(q -> head + q -> count) % q -> capacity] = msg;
+        q -> count++;
+    }
+
+    spin_unlock(&n -> lock);
+
+    // wq_has_sleeper orders the new seq before checking for waiters, so no waiter misses it
+    if(wq_has_sleeper(&n -> waiters))
+        wake_up_interruptible_poll(&n -> waiters, EPOLLIN | EPOLLRDNORM);
+
+    if(old != NULL)
+        drop_message(n -> store, old);
+
+    return 0;
+}
+
+/**
+ * Takes the oldest message off the channel's queue if it fits in length bytes (and with last_seq, if it's
+ * newer than *last_seq). The caller owns it
+ * @return 0 on success (*msg is NULL if the queue is empty, or its oldest message isn't newer), 1 if the channel
+ *         isn't in queue mode, -ENOSPC if the oldest message is longer than length, -EIDRM if the channel was deleted
+ */
+static int dequeue_message(node* n, const unsigned long* last_seq, size_t length, message** msg){
+    msg_queue* q;
+
+    *msg = NULL;
+
+    spin_lock(&n -> lock);
+
+    if(n -> dead){
+        spin_unlock(&n -> lock);
+        return -EIDRM;
+    }
+
+    q = n -> queue;
+
+    if(q == NULL || q -> count == 0 || (last_seq != NULL && q -> msgs[q -> head] -> seq <= READ_ONCE(*last_seq))){
+        spin_unlock(&n -> lock);
+        return q == NULL ? 1 : 0;
+    }
+
+    if(q -> msgs[q -> head] -> bytes > length){
+        spin_unlock(&n -> lock);
+        return -ENOSPC;
+    }
+
+    *msg = q -> msgs[q -> head];
+    q -> head = (q -> head + 1) % q -> capacity;
+    q -> count--;
+    spin_unlock(&n -> lock);
+
+    // the channel doesn't hold it anymore
+    uncharge(n -> store, message_size(*msg));
+
+    if(wq_has_sleeper(&n -> waiters))
+        wake_up_interruptible_poll(&n -> waiters, EPOLLOUT | EPOLLWRNORM);
+
+    return 0;
+}
+
+/**
+ * Puts the channel in queue mode with room for capacity messages, keeping the queued ones,
+ * or back to keeping only the last message if capacity is 0. Changing the mode drops the last message,
+ * so a message of one mode never shows up in the other
+ * @return 0 on success, -EBUSY if more than capacity messages are queued. OW, error value.
+ */
+int set_queue(node* n, unsigned int capacity){
+    msg_queue*     new_queue = NULL;
+    msg_queue*     old;
+    message*       last = NULL;
+    unsigned int   i;
+    int            err;
+
+    if(capacity > 0){
+        if(charge(n -> store, struct_size(new_queue, msgs, capacity)))
+            return -EDQUOT;
+
+        // next to the channel's messages, if its first writer placed them
+        new_queue = kvmalloc_node(struct_size(new_queue, msgs, capacity), GFP_KERNEL, READ_ONCE(n -> nid));
+
+        if(new_queue == NULL){
+            uncharge(n -> store, struct_size(new_queue, msgs, capacity));
+            return -ENOMEM;
+        }
+
+        new_queue -> capacity = capacity;
+        new_queue -> head = 0;
+        new_queue -> count = 0;
+    }
+
+    spin_lock(&n -> lock);
+    old = n -> queue;
+
+    if(n -> dead || (old != NULL && old -> count > capacity)){
+        err = n -> dead ? -EIDRM : -EBUSY;
+        spin_unlock(&n -> lock);
+        if(new_queue != NULL){
+            uncharge(n -> store, struct_size(new_queue, msgs, capacity));
+            kvfree(new_queue);
+        }
+        return err;
+    }
+
+    // back to the last message mode there is no new queue, and old is empty
+    if(old != NULL && new_queue != NULL){
+        for(i = 0; i < old -> count; i++)
+            new_queue -> msgs[i] = old -> msgs[(old -> head + i) % old -> capacity];
+        new_queue -> count = old -> count;
+    }
+
+    if((old == NULL) != (new_queue == NULL))
+        last = publish_message(n, NULL);
+
+    WRITE_ONCE(n -> queue, new_queue);
+    spin_unlock(&n -> lock);
+
+    if(last != NULL)
+        drop_message(n -> store, last);
+
+    if(old != NULL){
+        uncharge(n -> store, struct_size(old, msgs, old -> capacity));
+        kvfree(old);
+    }
+
+    // both readers and writers wait by the channel's mode
+    wake_up_interruptible_all(&n -> waiters);
+
+    return 0;
+}
+
+//================== WAITING ====================================
+
+/**
+ * Returns whether the channel has a message to read, by the channel's mode - with last_seq
+ * (MSG_SLOT_NEWER of a file, or MSG_SLOT_READ_SEQ), only a message newer than *last_seq counts:
+ * in queue mode the oldest queued message has to be
+ */
+bool has_message(node* n, const unsigned long* last_seq){
+    unsigned long seq = READ_ONCE(n -> seq);
+    msg_queue*    q;
+    bool          queued;
+
+    // a read of a deleted channel returns at once (with EIDRM)
+    if(READ_ONCE(n -> dead))
+        return true;
+
+    spin_lock(&n -> lock);
+    q = n -> queue;
+    queued = q != NULL && q -> count > 0 &&
+             (last_seq == NULL || q -> msgs[q -> head] -> seq > READ_ONCE(*last_seq));
+    spin_unlock(&n -> lock);
+
+    if(q != NULL)
+        return queued;
+
+    // the last message may have been dropped by a change of mode
+    if(rcu_access_pointer(n -> msg) == NULL)
+        return false;
+
+    if(last_seq != NULL)
+        return seq > READ_ONCE(*last_seq);
+
+    return true;
+}
+
+// Returns whether a write to the channel wouldn't wait for room
+bool has_room(node* n){
+    unsigned int  count;
+    unsigned int  capacity;
+
+    return READ_ONCE(n -> dead) || !queue_state(n, &count, &capacity) || count < capacity;
+}
+
+//================== NODES ======================================
+
+static void free_node_rcu(struct rcu_head* head){
+    node*   n = container_of(head, node, rcu);
+
+    // rings are only freed here, in case they were mapped
+    vfree(n -> ring);
+    kmem_cache_free(node_cache, n);
+}
+
+// Puts a reference to the node. The last one (the channel was deleted and nothing uses it) frees it
+void put_node(node* n){
+    if(!refcount_dec_and_test(&n -> refs))
+        return;
+
+    if(n -> ring != NULL)
+        uncharge(n -> store, n -> ring_bytes);
+    uncharge(n -> store, node_size());
+
+    // lookups may still be looking at it under rcu_read_lock
+    call_rcu(&n -> rcu, free_node_rcu);
+}
+
+/**
+ * Returns the node *ptr points to with a reference the caller has to put, or NULL if it points to none.
+ * *ptr holds a reference of its own, which is put only after *ptr was changed
+ */
+node* get_node(node** ptr){
+    node*   n;
+
+    rcu_read_lock();
+
+    do{
+        n = READ_ONCE(*ptr);
+    }while(n != NULL && !refcount_inc_not_zero(&n -> refs));
+
+    rcu_read_unlock();
+
+    return n;
+}
+
+// Points *ptr to n, which takes over the caller's reference, and puts the reference to the node it pointed to
+void set_node(node** ptr, node* n){
+    node*   old = xchg(ptr, n);
+
+    if(old != NULL)
+        put_node(old);
+}
+
+//================== CHANNELS ===================================
+
+// Returns the node of the given channel id in the store with a reference the caller has to put, or NULL if it doesn't exist
+node* find_channel(channel_store* s, unsigned long channel_id){
+    node*   n;
+
+    rcu_read_lock();
+
+    // a node with no references left is already out of the xarray
+    n = xa_load(&s -> channels, channel_id);
+    if(n != NULL && !refcount_inc_not_zero(&n -> refs))
+        n = NULL;
+
+    rcu_read_unlock();
+
+    return n;
+}
+
+/**
+ * Returns the node of the given channel id in the store with a reference the caller has to put,
+ * creating it if the channel doesn't exist yet
+ * @return the node on success. OW, ERR_PTR of the error value.
+ */
+node* get_channel(channel_store* s, unsigned long channel_id){
+    node*   n;
+    int     count;
+    int     err;
+
+    for(;;){
+        n = find_channel(s, channel_id);
+
+        if(n != NULL)
+            return n;
+
+        pr_debug("get_channel - channel id %lu doesn't exist\n", channel_id);
+
+        if(charge(s, node_size())){
+            pr_debug("get_channel - ERROR: the memory cap is reached\n");
+            return ERR_PTR(-EDQUOT);
+        }
+
+        n = kmem_cache_alloc(node_cache, GFP_KERNEL);
+
+        if(!n){
+            pr_debug("get_channel - ERROR: kmem_cache_alloc failed\n");
+            uncharge(s, node_size());
+            return ERR_PTR(-ENOMEM);
+        }
+
+        // the xarray's reference and the caller's
+        refcount_set(&n -> refs, 2);
+        n -> channel_id = channel_id;
+        n -> store = s;
+        n -> dead = false;
+        n -> last_write = jiffies;
+        n -> nid = NUMA_NO_NODE;
+        RCU_INIT_POINTER(n -> msg, NULL);
+        n -> ring = NULL;
+        n -> ring_bytes = 0;
+        n -> seq = 0;
+        n -> queue = NULL;
+        init_waitqueue_head(&n -> waiters);
+        spin_lock_init(&n -> lock);
+
+        err = xa_insert(&s -> channels, channel_id, n, GFP_KERNEL);
+
+        if(err){
+            kmem_cache_free(node_cache, n);
+            uncharge(s, node_size());
+        }
+
+        // a concurrent ioctl created the channel first - use its node
+        if(err == -EBUSY)
+            continue;
+
+        if(err){
+            pr_debug("get_channel - ERROR: xa_insert failed\n");
+            return ERR_PTR(err);
+        }
+
+        // counted out of pr_debug, which doesn't evaluate its arguments unless debug output is on
+        count = atomic_inc_return(&s -> num_of_nodes);
+        pr_debug("get_channel - There are currently %d open channels\n", count);
+
+        return n;
+    }
+}
+
+/**
+ * Deletes a node that was taken out of its store's xarray: marks it dead, drops its messages and its queue,
+ * wakes its waiters and puts the xarray's reference. The node itself is freed with its last reference
+ */
+static void kill_channel(node* n){
+    message*       msg;
+    msg_queue*     q;
+    unsigned int   i;
+
+    spin_lock(&n -> lock);
+    WRITE_ONCE(n -> dead, true);
+    msg = rcu_dereference_protected(n -> msg, lockdep_is_held(&n -> lock));
+    RCU_INIT_POINTER(n -> msg, NULL);
+    q = n -> queue;
+    WRITE_ONCE(n -> queue, NULL);
+    spin_unlock(&n -> lock);
+
+    // both readers and writers stop waiting on a dead channel
+    wake_up_interruptible_all(&n -> waiters);
+
+    if(msg != NULL)
+        drop_message(n -> store, msg);
+
+    if(q != NULL){
+        for(i = 0; i < q -> count; i++)
+            drop_message(n -> store, q -> msgs[(q -> head + i) % q -> capacity]);
+        uncharge(n -> store, struct_size(q, msgs, q -> capacity));
+        kvfree(q);
+    }
+
+    atomic_dec(&n -> store -> num_of_nodes);
+    put_node(n);
+}
+
+/**
+ * Deletes the channel of the given id from the store (MSG_SLOT_DELETE)
+ * @return 0 on success, -ENOENT if the store has no such channel
+ */
+int delete_channel(channel_store* s, unsigned long channel_id){
+    node*   n = xa_erase(&s -> channels, channel_id);
+
+    if(n == NULL)
+        return -ENOENT;
+
+    kill_channel(n);
+
+    return 0;
+}
+
+//================== CHANNEL I/O ================================
+
+/**
+ * Takes the message a read of the channel returns: in queue mode the oldest queued message (taking it
+ * off the queue), OW the last message - with last_seq, in both modes only if it's newer than *last_seq.
+ * If there is none and wait, waits for one
+ * @param last_seq - the reading file's last_seq with MSG_SLOT_NEWER (or MSG_SLOT_READ_SEQ's seq), OW NULL
+ * @return 0 with a message of up to length bytes in *msg, which the caller puts. OW, error value.
+ */
+int take_message(node* n, const unsigned long* last_seq, size_t length, bool wait, message** msg){
+    int    err;
+
+    for(;;){
+        err = dequeue_message(n, last_seq, length, msg);
+
+        if(err < 0)
+            return err;
+
+        if(err == 0 && *msg != NULL)
+            return 0;
+
+        if(err == 1){
+            *msg = get_message(n);
+
+            if(*msg != NULL && (last_seq == NULL || (*msg) -> seq > READ_ONCE(*last_seq)))
+                break;
+
+            if(*msg != NULL)
+                put_message(*msg);
+        }
+
+        if(!wait)
+            return -EWOULDBLOCK;
+
+        if(wait_event_interruptible(n -> waiters, has_message(n, last_seq)))
+            return -ERESTARTSYS;
+    }
+
+    // checking if the provided buffer length is too small
+    if((*msg) -> bytes > length){
+        put_message(*msg);
+        return -ENOSPC;
+    }
+
+    return 0;
+}
+
+/**
+ * Posts msg on the channel: in queue mode appends it (if wait, waiting for room if the queue is full),
+ * OW publishes it as the last message. Takes over the caller's reference, also on failure
+ * @return 0 on success. OW, error value.
+ */
+int post_message(node* n, message* msg, bool wait){
+    int   err;
+
+    while((err = store_message(n, msg)) == -EAGAIN){
+        if(!wait)
+            break;
+
+        if(wait_event_interruptible(n -> waiters, has_room(n))){
+            err = -ERESTARTSYS;
+            break;
+        }
+    }
+
+    if(err){
+        drop_message(n -> store, msg);
+        return err;
+    }
+
+    WRITE_ONCE(n -> last_write, jiffies);
+
+    return 0;
+}
+
+//==================== EVICTION =================================
+
+// Deletes the channels of the store that weren't written for ttl jiffies (unless they have a ring, which writes bypass)
+void evict_idle(channel_store* s, unsigned long ttl){
+    unsigned long   channel_id = 0;
+    node*           n;
+    bool            idle;
+
+    for(;;){
+        rcu_read_lock();
+
+        n = xa_find(&s -> channels, &channel_id, ULONG_MAX, XA_PRESENT);
+        idle = n != NULL && READ_ONCE(n -> ring) == NULL &&
+               time_after(jiffies, READ_ONCE(n -> last_write) + ttl) && refcount_inc_not_zero(&n -> refs);
+
+        rcu_read_unlock();
+
+        if(n == NULL)
+            break;
+
+        // only if it's still the channel's node - a deleted one may have been replaced meanwhile
+        if(idle){
+            if(xa_cmpxchg(&s -> channels, channel_id, n, NULL, GFP_KERNEL) == n){
+                pr_debug("evict_idle - deleting idle channel %lu\n", channel_id);
+                kill_channel(n);
+            }
+            put_node(n);
+        }
+
+        if(channel_id == ULONG_MAX)
+            break;
+
+        channel_id++;
+        cond_resched();
+    }
+}
+
+//================== SETUP ======================================
+
+void store_exit(void){
+    int   i;
+
+    for(i = 0; i < NUM_SIZE_CLASSES; i++){
+        kmem_cache_destroy(message_caches[i]);
+        message_caches[i] = NULL;
+    }
+
+    kmem_cache_destroy(node_cache);
+    node_cache = NULL;
+}
+
+// Makes the node and message caches
+int store_init(void){
+    int   i;
+
+    node_cache = kmem_cache_create("message_slot_node", sizeof(node), 0, align_nodes ? SLAB_HWCACHE_ALIGN : 0, NULL);
+
+    if(node_cache == NULL)
+        return -ENOMEM;
+
+    for(i = 0; i < NUM_SIZE_CLASSES; i++){
+        message_caches[i] = kmem_cache_create(size_class_names[i], size_classes[i], 0, 0, NULL);
+
+        if(message_caches[i] == NULL){
+            store_exit();
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+void init_store(channel_store* s){
+    xa_init(&s -> channels);
+    atomic_set(&s -> num_of_nodes, 0);
+    atomic_long_set(&s -> bytes, 0);
+}
+
+// Deletes the store's channels, one by one. Nodes still referenced (by files or mappings) are freed with their last reference
+void destroy_store(channel_store* s){
+    node*           n;
+    unsigned long   channel_id;
+
+    xa_for_each(&s -> channels, channel_id, n){
+        xa_erase(&s -> channels, channel_id);
+        kill_channel(n);
+    }
+
+    xa_destroy(&s -> channels);
+}
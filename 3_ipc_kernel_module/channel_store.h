@@ -0,0 +1,159 @@
+#ifndef EX3_CHANNEL_STORE_H
+#define EX3_CHANNEL_STORE_H
+
+/*
+ * The channel store of a message slot - its channels indexed by id, their messages and queues,
+ * and the locking and reference counting around them (see channel_store.c).
+ * It builds into the module, and with channel_store_user.h (a userspace shim of the kernel APIs
+ * it uses) into store_bench and store_fuzz, so it can be measured and tested without loading the module.
+ */
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/xarray.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
+#include <linux/spinlock.h>
+#include <linux/atomic.h>
+#include <linux/wait.h>
+#else
+#include "channel_store_user.h"
+#endif
+
+#include "message_slot.h"
+
+// struct for a message published on a channel
+typedef struct message{
+    struct rcu_head rcu;
+
+    // the channel's reference + one for each reader that is copying the message out
+    refcount_t refs;
+
+    // the message's sequence number on its channel
+    unsigned long seq;
+
+    // number of bytes in the message
+    int bytes;
+
+    // the size class the message was allocated from, or LARGE_MESSAGE
+    int size_class;
+
+    // the content of the message
+    char data[];
+}message;
+
+#define LARGE_MESSAGE (-1)
+
+// struct for a node (channel) in a store
+typedef struct node{
+    struct rcu_head rcu;
+
+    // the xarray's reference + one for each file that has the node set, cached or polled,
+    // each mapping of its ring and each read or write that is using it
+    refcount_t refs;
+
+    // the channel id of the node
+    unsigned long channel_id;
+
+    // the store the node is (or was) in
+    struct channel_store* store;
+
+    // set when the channel is deleted - the node is out of the xarray and has no messages
+    bool dead;
+
+    // jiffies of the channel's last write (or of its creation)
+    unsigned long last_write;
+
+    // NUMA node of the channel's first writer, which its messages are allocated on (numa_place),
+    // NUMA_NO_NODE until it has one
+    int nid;
+
+    // the last message written on the channel, NULL if none
+    message __rcu* msg;
+
+    // the channel's shared ring, NULL until it is first mapped
+    struct msg_slot_ring* ring;
+
+    // the bytes the ring was charged - not its header's size, which its mappings may rewrite
+    size_t ring_bytes;
+
+    // sequence number of the last message written on the channel, 0 if none
+    unsigned long seq;
+
+    // the channel's queue in queue mode, NULL when it only keeps the last message
+    struct msg_queue* queue;
+
+    // readers waiting for a message and writers waiting for room in the queue
+    wait_queue_head_t waiters;
+
+    // serializes the writers of the channel
+    spinlock_t lock;
+}node;
+
+// struct for the bounded ring of messages of a channel in queue mode
+typedef struct msg_queue{
+    unsigned int capacity;
+
+    // index of the oldest message
+    unsigned int head;
+
+    unsigned int count;
+    message* msgs[];
+}msg_queue;
+
+// struct for the channels of a message slot (one per minor) - its nodes indexed by channel id
+typedef struct channel_store{
+    struct xarray channels;
+    atomic_t num_of_nodes;
+
+    // bytes of the store's nodes, messages, queues and rings
+    atomic_long_t bytes;
+}channel_store;
+
+// caps of the bytes of one store / of all stores, 0 for no cap (the module's max_slot_bytes, max_total_bytes)
+extern unsigned long max_slot_bytes;
+extern unsigned long max_total_bytes;
+
+// bytes of all stores
+extern atomic_long_t total_bytes;
+
+// allocate a channel's messages and queue on the NUMA node of its first writer (the module's numa_place)
+extern bool numa_place;
+
+// cache-line-align nodes, so hot neighboring channels don't share a line (the module's align_nodes, read by store_init)
+extern bool align_nodes;
+
+int store_init(void);
+void store_exit(void);
+
+void init_store(channel_store* s);
+void destroy_store(channel_store* s);
+
+int charge(channel_store* s, size_t bytes);
+void uncharge(channel_store* s, size_t bytes);
+
+message* get_message(node* n);
+void put_message(message* msg);
+message* new_message(node* n, size_t bytes);
+void drop_message(channel_store* s, message* msg);
+
+bool queue_state(node* n, unsigned int* count, unsigned int* capacity);
+int set_queue(node* n, unsigned int capacity);
+
+bool has_message(node* n, const unsigned long* last_seq);
+bool has_room(node* n);
+
+void put_node(node* n);
+node* get_node(node** ptr);
+void set_node(node** ptr, node* n);
+
+node* find_channel(channel_store* s, unsigned long channel_id);
+node* get_channel(channel_store* s, unsigned long channel_id);
+int delete_channel(channel_store* s, unsigned long channel_id);
+void evict_idle(channel_store* s, unsigned long ttl);
+
+int take_message(node* n, const unsigned long* last_seq, size_t length, bool wait, message** msg);
+int post_message(node* n, message* msg, bool wait);
+
+#endif
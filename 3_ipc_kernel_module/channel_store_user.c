@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include "channel_store_user.h"
+
+/*
+Implementation of the userspace shim of channel_store_user.h - time, wait queues, RCU,
+kmem_caches and the xarray
+ */
+
+// ---------------------- time ---------------------- //
+
+unsigned long shim_jiffies(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * HZ + ts.tv_nsec / (1000000000 / HZ);
+}
+
+// ---------------------- wait queues ---------------------- //
+
+void init_waitqueue_head(wait_queue_head_t* wq){
+    pthread_mutex_init(&wq -> lock, NULL);
+    pthread_cond_init(&wq -> cond, NULL);
+    wq -> sleepers = 0;
+}
+
+// Orders the waker's change of the condition before the check, like the kernel's wq_has_sleeper
+bool wq_has_sleeper(wait_queue_head_t* wq){
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&wq -> sleepers, __ATOMIC_SEQ_CST) > 0;
+}
+
+void wake_up_all_shim(wait_queue_head_t* wq){
+    pthread_mutex_lock(&wq -> lock);
+    pthread_cond_broadcast(&wq -> cond);
+    pthread_mutex_unlock(&wq -> lock);
+}
+
+// ---------------------- RCU ---------------------- //
+
+#define RCU_MAX_THREADS 1024
+
+// callbacks a thread queues before it tries to run the ones whose grace period is over
+#define RCU_BATCH 32
+
+// the epoch a thread entered its read side section at, 0 outside of one. A cache line each
+typedef struct rcu_reader{
+    unsigned long epoch;
+    int used;
+    char pad[64 - sizeof(unsigned long) - sizeof(int)];
+}rcu_reader;
+
+static rcu_reader rcu_readers[RCU_MAX_THREADS];
+
+// one more than the highest slot ever used
+static int rcu_num_readers;
+
+static unsigned long rcu_epoch = 1;
+
+static __thread int rcu_id = -1;
+static __thread int rcu_nesting;
+
+// the thread's callbacks, oldest (lowest epoch) first
+static __thread struct rcu_head* rcu_pending;
+static __thread struct rcu_head* rcu_pending_tail;
+static __thread unsigned int rcu_pending_count;
+
+static void rcu_register(void){
+    int   expected;
+    int   n;
+
+    for(int i = 0; i < RCU_MAX_THREADS; i++){
+        expected = 0;
+        if(__atomic_compare_exchange_n(&rcu_readers[i].used, &expected, 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)){
+            rcu_id = i;
+
+            n = __atomic_load_n(&rcu_num_readers, __ATOMIC_SEQ_CST);
+            while(n < i + 1 && !__atomic_compare_exchange_n(&rcu_num_readers, &n, i + 1, false,
+                                                           __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+            return;
+        }
+    }
+
+    fprintf(stderr, "Error: more than %d threads use RCU\n", RCU_MAX_THREADS);
+    abort();
+}
+
+void rcu_read_lock(void){
+    if(rcu_nesting++ > 0)
+        return;
+
+    if(rcu_id < 0)
+        rcu_register();
+
+    // the reader's loads of RCU protected pointers come after it published its epoch
+    __atomic_store_n(&rcu_readers[rcu_id].epoch, __atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void rcu_read_unlock(void){
+    if(--rcu_nesting == 0)
+        __atomic_store_n(&rcu_readers[rcu_id].epoch, 0, __ATOMIC_RELEASE);
+}
+
+// Returns the epoch of the oldest reader in a read side section, ULONG_MAX if there is none
+static unsigned long rcu_oldest_reader(void){
+    unsigned long   oldest = ULONG_MAX;
+    unsigned long   epoch;
+    int             n = __atomic_load_n(&rcu_num_readers, __ATOMIC_SEQ_CST);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for(int i = 0; i < n; i++){
+        epoch = __atomic_load_n(&rcu_readers[i].epoch, __ATOMIC_SEQ_CST);
+        if(epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+
+    return oldest;
+}
+
+// Runs the thread's callbacks that no reader can still see - queued before the oldest reader entered
+static void rcu_reclaim(void){
+    unsigned long      oldest = rcu_oldest_reader();
+    struct rcu_head*   head;
+
+    while(rcu_pending != NULL && rcu_pending -> epoch < oldest){
+        head = rcu_pending;
+        rcu_pending = head -> next;
+        rcu_pending_count--;
+        head -> func(head);
+    }
+
+    if(rcu_pending == NULL)
+        rcu_pending_tail = NULL;
+}
+
+void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head* head)){
+    head -> func = func;
+    head -> next = NULL;
+
+    // readers that enter from now on get a later epoch, and can't find the object anymore
+    head -> epoch = __atomic_fetch_add(&rcu_epoch, 1, __ATOMIC_SEQ_CST);
+
+    if(rcu_pending_tail != NULL)
+        rcu_pending_tail -> next = head;
+    else
+        rcu_pending = head;
+    rcu_pending_tail = head;
+
+    if(++rcu_pending_count % RCU_BATCH == 0)
+        rcu_reclaim();
+}
+
+void rcu_barrier(void){
+    while(rcu_pending != NULL){
+        rcu_reclaim();
+        if(rcu_pending != NULL)
+            sched_yield();
+    }
+}
+
+void rcu_thread_exit(void){
+    rcu_barrier();
+
+    if(rcu_id >= 0){
+        __atomic_store_n(&rcu_readers[rcu_id].used, 0, __ATOMIC_SEQ_CST);
+        rcu_id = -1;
+    }
+}
+
+// ---------------------- memory ---------------------- //
+
+long shim_leaks;
+
+struct kmem_cache* kmem_cache_create(const char* name, unsigned int size, unsigned int align,
+                                     unsigned long flags, void (*ctor)(void*)){
+    struct kmem_cache* cache = calloc(1, sizeof(struct kmem_cache));
+
+    if(cache != NULL){
+        cache -> name = name;
+        cache -> align = (flags & SLAB_HWCACHE_ALIGN) ? L1_CACHE_BYTES : 0;
+        cache -> size = cache -> align ? (size + L1_CACHE_BYTES - 1) & ~(size_t)(L1_CACHE_BYTES - 1) : size;
+    }
+
+    return cache;
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache, gfp_t flags){
+    void* obj = cache -> align ? aligned_alloc(cache -> align, cache -> size) : malloc(cache -> size);
+
+    if(obj != NULL)
+        __atomic_add_fetch(&cache -> objects, 1, __ATOMIC_RELAXED);
+
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache* cache, void* obj){
+    __atomic_sub_fetch(&cache -> objects, 1, __ATOMIC_RELAXED);
+    free(obj);
+}
+
+void kmem_cache_destroy(struct kmem_cache* cache){
+    if(cache == NULL)
+        return;
+
+    if(cache -> objects != 0){
+        fprintf(stderr, "kmem_cache_destroy %s: %ld objects remaining\n", cache -> name, cache -> objects);
+        shim_leaks += cache -> objects;
+    }
+
+    free(cache);
+}
+
+// ---------------------- xarray ---------------------- //
+
+#define XA_BITS 6
+#define XA_SIZE (1 << XA_BITS)
+#define XA_MASK (XA_SIZE - 1)
+
+// a node of the radix tree - its slots are entries if shift is 0, OW nodes covering 1 << shift indices each
+struct xa_node{
+    unsigned int shift;
+    void* slots[XA_SIZE];
+};
+
+// Returns the highest index the tree under n covers
+static unsigned long xa_node_max(struct xa_node* n){
+    return n -> shift + XA_BITS >= 64 ? ULONG_MAX : (1UL << (n -> shift + XA_BITS)) - 1;
+}
+
+static struct xa_node* xa_new_node(unsigned int shift){
+    struct xa_node* n = calloc(1, sizeof(struct xa_node));
+
+    if(n != NULL)
+        n -> shift = shift;
+
+    return n;
+}
+
+static void xa_free_node(struct xa_node* n){
+    if(n -> shift > 0){
+        for(int i = 0; i < XA_SIZE; i++){
+            if(n -> slots[i] != NULL)
+                xa_free_node(n -> slots[i]);
+        }
+    }
+
+    free(n);
+}
+
+void xa_init(struct xarray* xa){
+    pthread_mutex_init(&xa -> lock, NULL);
+    xa -> root = NULL;
+}
+
+// Frees the tree. Like the kernel's, it doesn't free the entries
+void xa_destroy(struct xarray* xa){
+    if(xa -> root != NULL)
+        xa_free_node(xa -> root);
+
+    xa -> root = NULL;
+}
+
+void* xa_load(struct xarray* xa, unsigned long index){
+    struct xa_node* n = __atomic_load_n(&xa -> root, __ATOMIC_ACQUIRE);
+
+    if(n == NULL || index > xa_node_max(n))
+        return NULL;
+
+    while(n -> shift > 0){
+        n = __atomic_load_n(&n -> slots[(index >> n -> shift) & XA_MASK], __ATOMIC_ACQUIRE);
+        if(n == NULL)
+            return NULL;
+    }
+
+    return __atomic_load_n(&n -> slots[index & XA_MASK], __ATOMIC_ACQUIRE);
+}
+
+/*
+Returns the slot of index, making the nodes on the way to it if create (and growing the tree up).
+NULL if there's no such slot, or making a node failed. Called under xa -> lock
+ */
+static void** xa_slot(struct xarray* xa, unsigned long index, bool create){
+    struct xa_node*  n = xa -> root;
+    struct xa_node*  child;
+    void**           slot;
+
+    if(n == NULL){
+        if(!create || (n = xa_new_node(0)) == NULL)
+            return NULL;
+        __atomic_store_n(&xa -> root, n, __ATOMIC_RELEASE);
+    }
+
+    // a new root holds the old one at slot 0, so lookups racing with it find the same entries
+    while(index > xa_node_max(n)){
+        if(!create || (child = xa_new_node(n -> shift + XA_BITS)) == NULL)
+            return NULL;
+        child -> slots[0] = n;
+        __atomic_store_n(&xa -> root, child, __ATOMIC_RELEASE);
+        n = child;
+    }
+
+    while(n -> shift > 0){
+        slot = &n -> slots[(index >> n -> shift) & XA_MASK];
+        child = *slot;
+
+        if(child == NULL){
+            if(!create || (child = xa_new_node(n -> shift - XA_BITS)) == NULL)
+                return NULL;
+            __atomic_store_n(slot, child, __ATOMIC_RELEASE);
+        }
+
+        n = child;
+    }
+
+    return &n -> slots[index & XA_MASK];
+}
+
+int xa_insert(struct xarray* xa, unsigned long index, void* entry, gfp_t gfp){
+    void**  slot;
+    int     err = 0;
+
+    pthread_mutex_lock(&xa -> lock);
+    slot = xa_slot(xa, index, true);
+
+    if(slot == NULL)
+        err = -ENOMEM;
+    else if(*slot != NULL)
+        err = -EBUSY;
+    else
+        __atomic_store_n(slot, entry, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&xa -> lock);
+
+    return err;
+}
+
+void* xa_cmpxchg(struct xarray* xa, unsigned long index, void* old, void* entry, gfp_t gfp){
+    void**  slot;
+    void*   curr = NULL;
+
+    pthread_mutex_lock(&xa -> lock);
+    slot = xa_slot(xa, index, entry != NULL);
+
+    if(slot != NULL){
+        curr = *slot;
+        if(curr == old)
+            __atomic_store_n(slot, entry, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&xa -> lock);
+
+    return curr;
+}
+
+void* xa_erase(struct xarray* xa, unsigned long index){
+    void**  slot;
+    void*   old = NULL;
+
+    pthread_mutex_lock(&xa -> lock);
+    slot = xa_slot(xa, index, false);
+
+    if(slot != NULL){
+        old = *slot;
+        __atomic_store_n(slot, NULL, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&xa -> lock);
+
+    return old;
+}
+
+// Returns the first entry under n (which covers the indices from base) at *index or after it, up to max
+static void* xa_find_node(struct xa_node* n, unsigned long base, unsigned long* index, unsigned long max){
+    unsigned long   first;
+    unsigned long   slot_base;
+    void*           entry;
+    int             i;
+
+    i = *index > base ? (*index - base) >> n -> shift : 0;
+
+    for(; i < XA_SIZE; i++){
+        slot_base = base + ((unsigned long)i << n -> shift);
+
+        // past max, or past the top of the index space
+        if(slot_base > max || (i > 0 && slot_base <= base))
+            return NULL;
+
+        entry = __atomic_load_n(&n -> slots[i], __ATOMIC_ACQUIRE);
+
+        if(entry == NULL)
+            continue;
+
+        if(n -> shift == 0){
+            *index = slot_base;
+            return entry;
+        }
+
+        first = *index > slot_base ? *index : slot_base;
+        entry = xa_find_node(entry, slot_base, &first, max);
+
+        if(entry != NULL){
+            *index = first;
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+void* xa_find(struct xarray* xa, unsigned long* index, unsigned long max, int filter){
+    struct xa_node* n = __atomic_load_n(&xa -> root, __ATOMIC_ACQUIRE);
+
+    if(n == NULL || *index > max || *index > xa_node_max(n))
+        return NULL;
+
+    return xa_find_node(n, 0, index, max);
+}
+
+void* xa_find_after(struct xarray* xa, unsigned long* index, unsigned long max, int filter){
+    if(*index >= max)
+        return NULL;
+
+    (*index)++;
+
+    return xa_find(xa, index, max, filter);
+}
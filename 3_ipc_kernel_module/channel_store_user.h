@@ -0,0 +1,206 @@
+#ifndef EX3_CHANNEL_STORE_USER_H
+#define EX3_CHANNEL_STORE_USER_H
+
+/*
+ * Userspace shim of the kernel APIs channel_store.c uses, so the channel store builds
+ * into a userspace program (see store_bench.c, store_fuzz.c).
+ *
+ * - spinlocks are pthread mutexes, wait queues a mutex and a condition variable
+ * - atomics, refcounts, READ_ONCE / WRITE_ONCE are gcc __atomic builtins
+ * - RCU is epoch based: rcu_read_lock publishes the global epoch in the thread's slot,
+ *   call_rcu tags the object with the epoch (and advances it) and frees it once no reader
+ *   entered before that. Callbacks are kept per thread, so each thread that calls call_rcu
+ *   has to call rcu_thread_exit before it exits, and rcu_barrier only drains the caller's
+ * - the xarray is a radix tree of 64 slot nodes: lookups walk it without a lock (under rcu_read_lock),
+ *   changes take its mutex. Inner nodes are only freed by xa_destroy
+ * - kmem_caches count their objects, and kmem_cache_destroy reports the ones left (shim_leaks).
+ *   SLAB_HWCACHE_ALIGN caches hand out cache-line-aligned objects. There is one NUMA node
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <linux/types.h>
+
+typedef __u64 u64;
+typedef unsigned int gfp_t;
+
+#define GFP_KERNEL 0
+#define __rcu
+
+#define ERESTARTSYS 512
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define container_of(ptr, type, member) ((type*)((char*)(ptr) - offsetof(type, member)))
+#define struct_size(p, member, n) (sizeof(*(p)) + (size_t)(n) * sizeof(*(p) -> member))
+
+#define MAX_ERRNO 4095
+#define ERR_PTR(err) ((void*)(long)(err))
+#define PTR_ERR(ptr) ((long)(ptr))
+#define IS_ERR(ptr) ((unsigned long)(ptr) >= (unsigned long)-MAX_ERRNO)
+#define IS_ERR_OR_NULL(ptr) (!(ptr) || IS_ERR(ptr))
+
+// like the kernel's without debug output: arguments are checked but not evaluated
+#define pr_debug(...) ({ if(0) printf(__VA_ARGS__); 0; })
+#define cond_resched() do{}while(0)
+
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define WRITE_ONCE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define xchg(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define cmpxchg(p, old, new) __sync_val_compare_and_swap((p), (old), (new))
+
+// ---------------------- time ---------------------- //
+
+#define HZ 1000
+#define jiffies shim_jiffies()
+#define time_after(a, b) ((long)((b) - (a)) < 0)
+
+unsigned long shim_jiffies(void);
+
+// ---------------------- atomics ---------------------- //
+
+typedef struct { int counter; } atomic_t;
+typedef struct { long counter; } atomic_long_t;
+typedef struct { int refs; } refcount_t;
+
+#define atomic_set(a, v) __atomic_store_n(&(a) -> counter, (v), __ATOMIC_SEQ_CST)
+#define atomic_read(a) __atomic_load_n(&(a) -> counter, __ATOMIC_SEQ_CST)
+#define atomic_inc_return(a) __atomic_add_fetch(&(a) -> counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_dec(a) ((void)__atomic_sub_fetch(&(a) -> counter, 1, __ATOMIC_SEQ_CST))
+
+#define atomic_long_set(a, v) __atomic_store_n(&(a) -> counter, (v), __ATOMIC_SEQ_CST)
+#define atomic_long_read(a) __atomic_load_n(&(a) -> counter, __ATOMIC_SEQ_CST)
+#define atomic_long_add_return(v, a) __atomic_add_fetch(&(a) -> counter, (long)(v), __ATOMIC_SEQ_CST)
+#define atomic_long_sub(v, a) ((void)__atomic_sub_fetch(&(a) -> counter, (long)(v), __ATOMIC_SEQ_CST))
+
+#define refcount_set(r, v) __atomic_store_n(&(r) -> refs, (v), __ATOMIC_RELAXED)
+#define refcount_inc(r) ((void)__atomic_add_fetch(&(r) -> refs, 1, __ATOMIC_RELAXED))
+#define refcount_dec_and_test(r) (__atomic_sub_fetch(&(r) -> refs, 1, __ATOMIC_ACQ_REL) == 0)
+
+static inline bool refcount_inc_not_zero(refcount_t* r){
+    int refs = __atomic_load_n(&r -> refs, __ATOMIC_RELAXED);
+
+    do{
+        if(refs == 0)
+            return false;
+    }while(!__atomic_compare_exchange_n(&r -> refs, &refs, refs + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    return true;
+}
+
+// ---------------------- locks and wait queues ---------------------- //
+
+typedef pthread_mutex_t spinlock_t;
+
+#define spin_lock_init(l) pthread_mutex_init((l), NULL)
+#define spin_lock(l) pthread_mutex_lock(l)
+#define spin_unlock(l) pthread_mutex_unlock(l)
+#define lockdep_is_held(l) 1
+
+typedef struct wait_queue_head{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int sleepers;
+}wait_queue_head_t;
+
+void init_waitqueue_head(wait_queue_head_t* wq);
+bool wq_has_sleeper(wait_queue_head_t* wq);
+void wake_up_all_shim(wait_queue_head_t* wq);
+
+#define wake_up_interruptible_poll(wq, mask) wake_up_all_shim(wq)
+#define wake_up_interruptible_all(wq) wake_up_all_shim(wq)
+
+// sleepers is raised before the condition is checked, and a waker checks it after changing the condition
+#define wait_event_interruptible(wq, condition) ({                      \
+    wait_queue_head_t* __wq = &(wq);                                    \
+    pthread_mutex_lock(&__wq -> lock);                                  \
+    __atomic_add_fetch(&__wq -> sleepers, 1, __ATOMIC_SEQ_CST);         \
+    while(!(condition))                                                 \
+        pthread_cond_wait(&__wq -> cond, &__wq -> lock);                \
+    __atomic_sub_fetch(&__wq -> sleepers, 1, __ATOMIC_SEQ_CST);         \
+    pthread_mutex_unlock(&__wq -> lock);                                \
+    0;                                                                  \
+})
+
+// ---------------------- RCU ---------------------- //
+
+struct rcu_head{
+    struct rcu_head* next;
+    void (*func)(struct rcu_head* head);
+    unsigned long epoch;
+};
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head* head));
+void rcu_barrier(void);
+void rcu_thread_exit(void);
+
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_dereference_protected(p, c) (p)
+#define rcu_access_pointer(p) __atomic_load_n(&(p), __ATOMIC_RELAXED)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define RCU_INIT_POINTER(p, v) ((p) = (v))
+
+// ---------------------- memory ---------------------- //
+
+#define SLAB_HWCACHE_ALIGN 0x2000UL
+#define L1_CACHE_BYTES 64
+
+// a single NUMA node
+#define NUMA_NO_NODE (-1)
+#define numa_node_id() 0
+
+struct kmem_cache{
+    const char* name;
+    size_t size;
+    size_t align;
+    long objects;
+};
+
+// objects left in caches when they were destroyed
+extern long shim_leaks;
+
+struct kmem_cache* kmem_cache_create(const char* name, unsigned int size, unsigned int align,
+                                     unsigned long flags, void (*ctor)(void*));
+void* kmem_cache_alloc(struct kmem_cache* cache, gfp_t flags);
+void kmem_cache_free(struct kmem_cache* cache, void* obj);
+#define kmem_cache_size(cache) ((unsigned int)(cache) -> size)
+#define kmem_cache_alloc_node(cache, flags, nid) kmem_cache_alloc(cache, flags)
+void kmem_cache_destroy(struct kmem_cache* cache);
+
+#define kvmalloc(size, flags) malloc(size)
+#define kvmalloc_node(size, flags, nid) malloc(size)
+#define kvfree(p) free(p)
+#define vfree(p) free(p)
+
+// ---------------------- xarray ---------------------- //
+
+struct xa_node;
+
+struct xarray{
+    pthread_mutex_t lock;
+    struct xa_node* root;
+};
+
+#define XA_PRESENT 1
+
+void xa_init(struct xarray* xa);
+void xa_destroy(struct xarray* xa);
+void* xa_load(struct xarray* xa, unsigned long index);
+int xa_insert(struct xarray* xa, unsigned long index, void* entry, gfp_t gfp);
+void* xa_erase(struct xarray* xa, unsigned long index);
+void* xa_cmpxchg(struct xarray* xa, unsigned long index, void* old, void* entry, gfp_t gfp);
+void* xa_find(struct xarray* xa, unsigned long* index, unsigned long max, int filter);
+void* xa_find_after(struct xarray* xa, unsigned long* index, unsigned long max, int filter);
+
+#define xa_for_each(xa, index, entry)                                                   \
+    for(index = 0, entry = xa_find(xa, &index, ULONG_MAX, XA_PRESENT); entry != NULL;   \
+        entry = xa_find_after(xa, &index, ULONG_MAX, XA_PRESENT))
+
+#endif
@@ -0,0 +1,1099 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <stdbool.h>
+#include "message_slot.h"
+
+#define IOCTLS_PER_ROUND 200000
+
+#define STRESS_CHANNEL 1
+#define RW_CHANNEL 2
+#define MMAP_CHANNEL 3
+#define MMAP_MESSAGES 2000000
+#define EPOLL_CHANNEL_BASE 1000
+#define EPOLL_MESSAGES 100000
+#define QUEUE_CHANNEL 4
+#define QUEUE_MESSAGES 1000000
+#define VEC_CHANNEL_BASE 2000
+#define VEC_TICKS 20000
+#define RW_OPS 200000
+#define STRESS_WRITERS 2
+#define MAX_PROCS 256
+#define PINNED_CHANNEL_BASE 3000
+#define FANOUT_CHANNEL 5
+#define FANOUT_MESSAGES 20000
+#define FANOUT_INTERVAL_NS 20000
+
+// counters of a stress run, shared by all of its processes
+typedef struct stress_counters{
+    volatile int stop;
+    long long reads[MAX_PROCS];
+    long long writes[MAX_PROCS];
+    long long torn[MAX_PROCS];
+}stress_counters;
+
+long long now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Spreads the i-th channel id over 32 bits (a bijection, so ids never repeat) and never 0
+unsigned long channel_of(unsigned long i){
+    return (unsigned long)(unsigned int)((i + 1) * 2654435761u);
+}
+
+void set_channel(int fd, unsigned long channel_id){
+    if(ioctl(fd, MSG_SLOT_CHANNEL, channel_id) < 0){
+        fprintf(stderr, "Error: ioctl(%lu): %s\n", channel_id, strerror(errno));
+        exit(1);
+    }
+}
+
+// ---------------------- benchmarks ---------------------- //
+
+/*
+Latency of switching to an existing channel as the number of channels in the slot grows.
+Should stay flat: channels are looked up by id, not by walking the slot
+ */
+void bench_ioctl(int fd, unsigned long max_channels){
+    unsigned long created = 0;
+
+    printf("%12s %14s\n", "channels", "ns/ioctl");
+
+    for(unsigned long channels = 1; channels <= max_channels; channels *= 10){
+        for(; created < channels; created++)
+            set_channel(fd, channel_of(created));
+
+        srandom(channels);
+        long long start = now_ns();
+        for(int i = 0; i < IOCTLS_PER_ROUND; i++)
+            set_channel(fd, channel_of(random() % channels));
+        long long elapsed = now_ns() - start;
+
+        printf("%12lu %14.1f\n", channels, (double)elapsed / IOCTLS_PER_ROUND);
+    }
+}
+
+int open_channel(char* path, unsigned long channel_id){
+    int fd = open(path, O_RDWR);
+
+    if(fd < 0){
+        fprintf(stderr, "Error: couldn't open the given file at path: %s\n", path);
+        exit(1);
+    }
+
+    set_channel(fd, channel_id);
+    return fd;
+}
+
+/*
+Writes messages whose bytes all equal a tag, and whose length is derived from the tag,
+so a reader can tell a whole message from a torn one
+ */
+void stress_writer(char* path, int id, stress_counters* c){
+    int fd = open_channel(path, STRESS_CHANNEL);
+    char buffer[BUF_LEN];
+
+    for(unsigned int i = 0; !c -> stop; i++){
+        unsigned char tag = (unsigned char)(i * 31 + id);
+        int len = 1 + tag % BUF_LEN;
+
+        memset(buffer, tag, len);
+        if(write(fd, buffer, len) != len){
+            fprintf(stderr, "Error: write: %s\n", strerror(errno));
+            exit(1);
+        }
+        c -> writes[id]++;
+    }
+
+    exit(0);
+}
+
+void stress_reader(char* path, int id, stress_counters* c){
+    int fd = open_channel(path, STRESS_CHANNEL);
+    unsigned char buffer[BUF_LEN];
+
+    while(!c -> stop){
+        int n = read(fd, buffer, BUF_LEN);
+
+        if(n < 0){
+            if(errno == EWOULDBLOCK)
+                continue;
+            fprintf(stderr, "Error: read: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        int torn = (n != 1 + buffer[0] % BUF_LEN);
+        for(int i = 1; i < n && !torn; i++)
+            torn = (buffer[i] != buffer[0]);
+
+        c -> torn[id] += torn;
+        c -> reads[id]++;
+    }
+
+    exit(0);
+}
+
+/*
+Multi-process stress test: STRESS_WRITERS writers and 1, 2, 4, ... max_readers readers on one
+channel, each with its own fd. Reports the throughput by reader count and any torn message
+ */
+void bench_stress(char* path, int max_readers, int seconds){
+    stress_counters* c = mmap(NULL, sizeof(stress_counters), PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if(c == MAP_FAILED){
+        fprintf(stderr, "Error: mmap: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    if(max_readers + STRESS_WRITERS > MAX_PROCS)
+        max_readers = MAX_PROCS - STRESS_WRITERS;
+
+    printf("%8s %14s %16s %14s %8s\n", "readers", "reads/s", "reads/s/reader", "writes/s", "torn");
+
+    for(int readers = 1; readers <= max_readers; readers *= 2){
+        int procs = STRESS_WRITERS + readers;
+        long long reads = 0, writes = 0, torn = 0;
+
+        memset(c, 0, sizeof(*c));
+        fflush(stdout);
+
+        for(int i = 0; i < procs; i++){
+            pid_t pid = fork();
+
+            if(pid < 0){
+                fprintf(stderr, "Error: fork: %s\n", strerror(errno));
+                exit(1);
+            }
+
+            if(pid == 0){
+                if(i < STRESS_WRITERS)
+                    stress_writer(path, i, c);
+                else
+                    stress_reader(path, i, c);
+            }
+        }
+
+        sleep(seconds);
+        c -> stop = 1;
+
+        for(int i = 0; i < procs; i++)
+            wait(NULL);
+
+        for(int i = 0; i < procs; i++){
+            reads += c -> reads[i];
+            writes += c -> writes[i];
+            torn += c -> torn[i];
+        }
+
+        printf("%8d %14.0f %16.0f %14.0f %8lld\n", readers, (double)reads / seconds,
+               (double)reads / seconds / readers, (double)writes / seconds, torn);
+    }
+
+    munmap(c, sizeof(*c));
+}
+
+/*
+Latency of a write and of a read of a message of each size, from 1 byte to max_len
+(the module's max_msg_len). Run against the module before and after a change to the copy
+paths or to how messages are allocated
+ */
+void bench_rw(int fd, int max_len){
+    int sizes[] = {1, 16, 64, 128, 512, 4096, 16384, 65536, MAX_BUF_LEN};
+    char* buffer = malloc(MAX_BUF_LEN);
+
+    if(buffer == NULL){
+        fprintf(stderr, "Error: malloc: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    memset(buffer, 'x', MAX_BUF_LEN);
+    set_channel(fd, RW_CHANNEL);
+
+    printf("%8s %14s %14s\n", "bytes", "ns/write", "ns/read");
+
+    for(int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])) && sizes[i] <= max_len; i++){
+        long long start = now_ns();
+        for(int j = 0; j < RW_OPS; j++){
+            if(write(fd, buffer, sizes[i]) != sizes[i]){
+                fprintf(stderr, "Error: write: %s\n", strerror(errno));
+                exit(1);
+            }
+        }
+        long long write_ns = now_ns() - start;
+
+        start = now_ns();
+        for(int j = 0; j < RW_OPS; j++){
+            if(read(fd, buffer, MAX_BUF_LEN) != sizes[i]){
+                fprintf(stderr, "Error: read: %s\n", strerror(errno));
+                exit(1);
+            }
+        }
+        long long read_ns = now_ns() - start;
+
+        printf("%8d %14.1f %14.1f\n", sizes[i], (double)write_ns / RW_OPS, (double)read_ns / RW_OPS);
+    }
+
+    free(buffer);
+}
+
+// ---------------------- shared ring ---------------------- //
+
+// a mapped channel ring
+typedef struct ring{
+    struct msg_slot_ring* header;
+    char* data;
+    __u64 mask;
+    size_t len;
+}ring;
+
+#define RECORD_LEN(bytes) (((__u64)sizeof(__u32) + (bytes) + MSG_SLOT_RING_ALIGN - 1) & ~(__u64)(MSG_SLOT_RING_ALIGN - 1))
+
+// Maps the whole ring of the channel set on fd
+void map_ring(int fd, ring* r){
+    struct msg_slot_ring* header = mmap(NULL, MSG_SLOT_RING_DATA, PROT_READ, MAP_SHARED, fd, 0);
+
+    if(header == MAP_FAILED){
+        fprintf(stderr, "Error: mmap: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    r -> len = MSG_SLOT_RING_DATA + header -> size;
+    munmap(header, MSG_SLOT_RING_DATA);
+
+    r -> header = mmap(NULL, r -> len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if(r -> header == MAP_FAILED){
+        fprintf(stderr, "Error: mmap: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    r -> data = (char*)r -> header + MSG_SLOT_RING_DATA;
+    r -> mask = r -> header -> size - 1;
+}
+
+// Copies len bytes from src to the data area at position pos, wrapping around its end
+void ring_copy_in(ring* r, __u64 pos, const char* src, size_t len){
+    size_t offset = pos & r -> mask;
+    size_t first = len < r -> mask + 1 - offset ? len : r -> mask + 1 - offset;
+
+    memcpy(r -> data + offset, src, first);
+    memcpy(r -> data, src + first, len - first);
+}
+
+void ring_copy_out(ring* r, __u64 pos, char* dst, size_t len){
+    size_t offset = pos & r -> mask;
+    size_t first = len < r -> mask + 1 - offset ? len : r -> mask + 1 - offset;
+
+    memcpy(dst, r -> data + offset, first);
+    memcpy(dst + first, r -> data, len - first);
+}
+
+// Appends a message of len bytes. Returns 0 if the ring is too full for it
+int ring_push(ring* r, const char* msg, __u32 len){
+    __u64 head = r -> header -> head;
+    __u64 tail = __atomic_load_n(&r -> header -> tail, __ATOMIC_ACQUIRE);
+
+    if(head + RECORD_LEN(len) - tail > r -> mask + 1)
+        return 0;
+
+    // records are aligned, so the length never wraps
+    *(__u32*)(r -> data + (head & r -> mask)) = len;
+    ring_copy_in(r, head + sizeof(__u32), msg, len);
+
+    __atomic_store_n(&r -> header -> head, head + RECORD_LEN(len), __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Takes the oldest message into buffer. Returns its length, or -1 if the ring is empty
+int ring_pop(ring* r, char* buffer){
+    __u64 tail = r -> header -> tail;
+    __u64 head = __atomic_load_n(&r -> header -> head, __ATOMIC_ACQUIRE);
+    __u32 len;
+
+    if(head == tail)
+        return -1;
+
+    len = *(__u32*)(r -> data + (tail & r -> mask));
+    ring_copy_out(r, tail + sizeof(__u32), buffer, len);
+
+    __atomic_store_n(&r -> header -> tail, tail + RECORD_LEN(len), __ATOMIC_RELEASE);
+    return len;
+}
+
+/*
+Consumes count messages of len bytes from the channel's ring, checking that they arrive whole
+and in order (each message's bytes all equal its index)
+ */
+void ring_consumer(char* path, int len, int count){
+    int fd = open_channel(path, MMAP_CHANNEL);
+    char buffer[4096];
+    ring r;
+
+    map_ring(fd, &r);
+
+    for(int i = 0; i < count; i++){
+        int n;
+
+        while((n = ring_pop(&r, buffer)) < 0)
+            sched_yield();
+
+        if(n != len || buffer[0] != (char)i || buffer[n - 1] != (char)i){
+            fprintf(stderr, "Error: message %d arrived torn or out of order\n", i);
+            exit(1);
+        }
+    }
+
+    exit(0);
+}
+
+/*
+Messages per second through a channel's shared ring (a producer and a consumer process)
+vs. through write() + read() of the same channel, for each size up to max_len
+ */
+void bench_mmap(char* path, int fd, int max_len){
+    int sizes[] = {16, 64, 128, 512, 4096};
+    char buffer[4096];
+    ring r;
+
+    set_channel(fd, MMAP_CHANNEL);
+    map_ring(fd, &r);
+
+    printf("%8s %16s %16s\n", "bytes", "ring msgs/s", "syscall msgs/s");
+
+    for(int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++){
+        // the consumer exits through exit(), which would flush a copy of our stdout
+        fflush(stdout);
+
+        long long start = now_ns();
+        pid_t pid = fork();
+
+        if(pid < 0){
+            fprintf(stderr, "Error: fork: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        if(pid == 0)
+            ring_consumer(path, sizes[i], MMAP_MESSAGES);
+
+        for(int j = 0; j < MMAP_MESSAGES; j++){
+            memset(buffer, (char)j, sizes[i]);
+            while(!ring_push(&r, buffer, sizes[i]))
+                sched_yield();
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            exit(1);
+
+        double ring_rate = MMAP_MESSAGES * 1e9 / (now_ns() - start);
+
+        // the syscall path has no queue - a message is delivered by a write() and a read()
+        if(sizes[i] > max_len){
+            printf("%8d %16.0f %16s\n", sizes[i], ring_rate, "-");
+            continue;
+        }
+
+        start = now_ns();
+        for(int j = 0; j < RW_OPS; j++){
+            if(write(fd, buffer, sizes[i]) != sizes[i] || read(fd, buffer, sizeof(buffer)) != sizes[i]){
+                fprintf(stderr, "Error: write/read: %s\n", strerror(errno));
+                exit(1);
+            }
+        }
+
+        printf("%8d %16.0f %16.0f\n", sizes[i], ring_rate, RW_OPS * 1e9 / (now_ns() - start));
+    }
+
+    munmap(r.header, r.len);
+}
+
+// ---------------------- epoll ---------------------- //
+
+int cmp_ll(const void* a, const void* b){
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+// Opens a file per channel, each with its own channel and MSG_SLOT_NEWER
+void open_epoll_channels(char* path, int* fds, int channels){
+    for(int i = 0; i < channels; i++){
+        fds[i] = open_channel(path, EPOLL_CHANNEL_BASE + i);
+
+        if(ioctl(fds[i], MSG_SLOT_FLAGS, MSG_SLOT_NEWER) < 0){
+            fprintf(stderr, "Error: ioctl(MSG_SLOT_FLAGS): %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+}
+
+/*
+Writes EPOLL_MESSAGES messages, each to a random channel and holding its send time,
+one at a time - the next is sent once the consumer counted the last one in *done
+ */
+void epoll_writer(char* path, int channels, volatile long long* done){
+    int* fds = malloc(sizeof(int) * channels);
+
+    open_epoll_channels(path, fds, channels);
+    srandom(getpid());
+
+    for(long long i = 0; i < EPOLL_MESSAGES; i++){
+        long long sent = now_ns();
+
+        if(write(fds[random() % channels], &sent, sizeof(sent)) != sizeof(sent)){
+            fprintf(stderr, "Error: write: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        while(*done <= i)
+            sched_yield();
+    }
+
+    exit(0);
+}
+
+/*
+Event driven consumer of channels channels: an epoll set of a file per channel (MSG_SLOT_NEWER,
+so a file is readable only when its channel has an unread message) and a writer process.
+Reports the messages per second and the latency from write() to the consumer's read()
+ */
+void bench_epoll(char* path, int channels){
+    long long* latencies = malloc(sizeof(long long) * EPOLL_MESSAGES);
+    int* fds = malloc(sizeof(int) * channels);
+    volatile long long* done = mmap(NULL, sizeof(long long), PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    struct epoll_event events[64];
+    long long received = 0;
+    int ep = epoll_create1(0);
+
+    if(latencies == NULL || fds == NULL || done == MAP_FAILED || ep < 0){
+        fprintf(stderr, "Error: setting up: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    open_epoll_channels(path, fds, channels);
+
+    for(int i = 0; i < channels; i++){
+        struct epoll_event ev = {.events = EPOLLIN, .data.fd = fds[i]};
+
+        // consume what an earlier run left, so every file starts with nothing newer to read
+        long long stale;
+        while(read(fds[i], &stale, sizeof(stale)) > 0);
+
+        if(epoll_ctl(ep, EPOLL_CTL_ADD, fds[i], &ev) < 0){
+            fprintf(stderr, "Error: epoll_ctl: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+
+    *done = 0;
+    fflush(stdout);
+
+    long long start = now_ns();
+    pid_t pid = fork();
+
+    if(pid < 0){
+        fprintf(stderr, "Error: fork: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    if(pid == 0)
+        epoll_writer(path, channels, done);
+
+    while(received < EPOLL_MESSAGES){
+        int n = epoll_wait(ep, events, 64, -1);
+
+        for(int i = 0; i < n; i++){
+            long long sent;
+
+            if(read(events[i].data.fd, &sent, sizeof(sent)) != sizeof(sent)){
+                fprintf(stderr, "Error: read: %s\n", strerror(errno));
+                exit(1);
+            }
+
+            latencies[received++] = now_ns() - sent;
+            *done = received;
+        }
+    }
+
+    long long elapsed = now_ns() - start;
+    waitpid(pid, NULL, 0);
+    qsort(latencies, EPOLL_MESSAGES, sizeof(long long), cmp_ll);
+
+    printf("%8s %14s %12s %12s %12s\n", "channels", "msgs/s", "p50 us", "p99 us", "max us");
+    printf("%8d %14.0f %12.1f %12.1f %12.1f\n", channels, EPOLL_MESSAGES * 1e9 / elapsed,
+           latencies[EPOLL_MESSAGES / 2] / 1000.0, latencies[EPOLL_MESSAGES * 99 / 100] / 1000.0,
+           latencies[EPOLL_MESSAGES - 1] / 1000.0);
+
+    close(ep);
+    for(int i = 0; i < channels; i++)
+        close(fds[i]);
+    free(fds);
+    free(latencies);
+}
+
+// ---------------------- queue ---------------------- //
+
+// Opens a file of the queue channel that waits when the queue is full or empty
+int open_queue_channel(char* path){
+    int fd = open_channel(path, QUEUE_CHANNEL);
+
+    if(ioctl(fd, MSG_SLOT_FLAGS, MSG_SLOT_BLOCK) < 0){
+        fprintf(stderr, "Error: ioctl(MSG_SLOT_FLAGS): %s\n", strerror(errno));
+        exit(1);
+    }
+
+    return fd;
+}
+
+// Queues QUEUE_MESSAGES messages, each holding its index
+void queue_producer(char* path){
+    int fd = open_queue_channel(path);
+
+    for(long long i = 0; i < QUEUE_MESSAGES; i++){
+        if(write(fd, &i, sizeof(i)) != sizeof(i)){
+            fprintf(stderr, "Error: write: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+
+    exit(0);
+}
+
+// Checks that the next message holds the next index
+void check_next(long long* expected, long long got){
+    if(got != *expected){
+        fprintf(stderr, "Error: expected message %lld, got %lld\n", *expected, got);
+        exit(1);
+    }
+    (*expected)++;
+}
+
+/*
+Messages per second through a queue of the given capacity, from a producer process to a consumer
+that reads one message per read() or drains up to batch messages per MSG_SLOT_READ_BATCH
+ */
+double queue_throughput(char* path, int fd, int batch){
+    char buffer[64 * 1024];
+    long long expected = 0;
+
+    fflush(stdout);
+
+    long long start = now_ns();
+    pid_t pid = fork();
+
+    if(pid < 0){
+        fprintf(stderr, "Error: fork: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    if(pid == 0)
+        queue_producer(path);
+
+    while(expected < QUEUE_MESSAGES){
+        if(batch == 0){
+            long long got;
+
+            if(read(fd, &got, sizeof(got)) != sizeof(got)){
+                fprintf(stderr, "Error: read: %s\n", strerror(errno));
+                exit(1);
+            }
+            check_next(&expected, got);
+            continue;
+        }
+
+        struct msg_slot_batch b = {.buffer = (__u64)(unsigned long)buffer, .length = sizeof(buffer), .count = batch};
+
+        if(ioctl(fd, MSG_SLOT_READ_BATCH, &b) < 0){
+            fprintf(stderr, "Error: ioctl(MSG_SLOT_READ_BATCH): %s\n", strerror(errno));
+            exit(1);
+        }
+
+        for(__u32 offset = 0, i = 0; i < b.count; i++, offset += RECORD_LEN(sizeof(long long))){
+            long long got;
+            memcpy(&got, buffer + offset + sizeof(__u32), sizeof(got));
+            check_next(&expected, got);
+        }
+    }
+
+    waitpid(pid, NULL, 0);
+    return QUEUE_MESSAGES * 1e9 / (now_ns() - start);
+}
+
+void bench_queue(char* path, int capacity){
+    int batches[] = {0, 8, 64, 512};
+    int fd = open_queue_channel(path);
+
+    // an earlier run may have left more messages queued than capacity - drain them first
+    long long stale;
+    ioctl(fd, MSG_SLOT_FLAGS, 0);
+    if(ioctl(fd, MSG_SLOT_QUEUE, MSG_SLOT_MAX_QUEUE) == 0)
+        while(read(fd, &stale, sizeof(stale)) > 0);
+    ioctl(fd, MSG_SLOT_FLAGS, MSG_SLOT_BLOCK);
+
+    if(ioctl(fd, MSG_SLOT_QUEUE, capacity) < 0){
+        fprintf(stderr, "Error: ioctl(MSG_SLOT_QUEUE): %s\n", strerror(errno));
+        exit(1);
+    }
+
+    printf("queue of %d, %d messages\n", capacity, QUEUE_MESSAGES);
+    printf("%8s %14s\n", "batch", "msgs/s");
+
+    for(int i = 0; i < (int)(sizeof(batches) / sizeof(batches[0])); i++){
+        if(batches[i] == 0)
+            printf("%8s %14.0f\n", "read()", queue_throughput(path, fd, 0));
+        else
+            printf("%8d %14.0f\n", batches[i], queue_throughput(path, fd, batches[i]));
+    }
+
+    close(fd);
+}
+
+// ---------------------- vec ---------------------- //
+
+/*
+Cost of a tick that writes and then reads a message of each of channels channels: one
+ioctl(MSG_SLOT_CHANNEL) + write() / read() per channel vs. a pwrite() / pread() per channel
+(MSG_SLOT_POSITIONAL) vs. one MSG_SLOT_WRITE_VEC + one MSG_SLOT_READ_VEC
+ */
+void bench_vec(int fd, int channels){
+    struct msg_slot_vec* v = malloc(sizeof(struct msg_slot_vec) * channels);
+    char (*buffers)[BUF_LEN] = malloc((size_t)BUF_LEN * channels);
+    struct msg_slot_vecs vecs = {.vecs = (__u64)(unsigned long)v, .count = channels};
+
+    if(v == NULL || buffers == NULL){
+        fprintf(stderr, "Error: malloc: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    memset(buffers, 'x', (size_t)BUF_LEN * channels);
+
+    long long start = now_ns();
+    for(int t = 0; t < VEC_TICKS; t++){
+        for(int i = 0; i < channels; i++){
+            set_channel(fd, VEC_CHANNEL_BASE + i);
+            if(write(fd, buffers[i], 64) != 64 || read(fd, buffers[i], BUF_LEN) != 64){
+                fprintf(stderr, "Error: write/read: %s\n", strerror(errno));
+                exit(1);
+            }
+        }
+    }
+    long long loop_ns = now_ns() - start;
+
+    start = now_ns();
+    for(int t = 0; t < VEC_TICKS; t++){
+        for(int i = 0; i < channels; i++)
+            v[i] = (struct msg_slot_vec){.channel_id = VEC_CHANNEL_BASE + i,
+                                         .buffer = (__u64)(unsigned long)buffers[i], .length = 64};
+
+        if(ioctl(fd, MSG_SLOT_WRITE_VEC, &vecs) < 0){
+            fprintf(stderr, "Error: ioctl(MSG_SLOT_WRITE_VEC): %s\n", strerror(errno));
+            exit(1);
+        }
+
+        for(int i = 0; i < channels; i++)
+            v[i].length = BUF_LEN;
+
+        if(ioctl(fd, MSG_SLOT_READ_VEC, &vecs) < 0){
+            fprintf(stderr, "Error: ioctl(MSG_SLOT_READ_VEC): %s\n", strerror(errno));
+            exit(1);
+        }
+
+        for(int i = 0; i < channels; i++){
+            if(v[i].result != 64){
+                fprintf(stderr, "Error: channel %d: %s\n", VEC_CHANNEL_BASE + i, strerror(-v[i].result));
+                exit(1);
+            }
+        }
+    }
+    long long vec_ns = now_ns() - start;
+
+    // the offset of each pread / pwrite is its channel
+    if(ioctl(fd, MSG_SLOT_FLAGS, MSG_SLOT_POSITIONAL) < 0){
+        fprintf(stderr, "Error: ioctl(MSG_SLOT_FLAGS): %s\n", strerror(errno));
+        exit(1);
+    }
+
+    start = now_ns();
+    for(int t = 0; t < VEC_TICKS; t++){
+        for(int i = 0; i < channels; i++){
+            if(pwrite(fd, buffers[i], 64, VEC_CHANNEL_BASE + i) != 64 ||
+               pread(fd, buffers[i], BUF_LEN, VEC_CHANNEL_BASE + i) != 64){
+                fprintf(stderr, "Error: pwrite/pread: %s\n", strerror(errno));
+                exit(1);
+            }
+        }
+    }
+    long long positional_ns = now_ns() - start;
+
+    ioctl(fd, MSG_SLOT_FLAGS, 0);
+
+    printf("%d channels per tick, 64 byte messages\n", channels);
+    printf("  %-28s %10.1f us/tick\n", "ioctl + write + read each", loop_ns / 1000.0 / VEC_TICKS);
+    printf("  %-28s %10.1f us/tick\n", "pwrite + pread each", positional_ns / 1000.0 / VEC_TICKS);
+    printf("  %-28s %10.1f us/tick\n", "WRITE_VEC + READ_VEC", vec_ns / 1000.0 / VEC_TICKS);
+
+    free(v);
+    free(buffers);
+}
+
+// ---------------------- pinned ---------------------- //
+
+void pin_to_cpu(int cpu){
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    if(sched_setaffinity(0, sizeof(set), &set) < 0){
+        fprintf(stderr, "Error: sched_setaffinity(%d): %s\n", cpu, strerror(errno));
+        exit(1);
+    }
+}
+
+// Writes the pair's channel until stop, from cpu
+void pinned_producer(char* path, int pair, int cpu, stress_counters* c){
+    int fd = open_channel(path, PINNED_CHANNEL_BASE + pair);
+    char buffer[64] = {0};
+
+    pin_to_cpu(cpu);
+
+    for(long long i = 0; !c -> stop; i++){
+        memcpy(buffer, &i, sizeof(i));
+        if(write(fd, buffer, sizeof(buffer)) != sizeof(buffer)){
+            fprintf(stderr, "Error: write: %s\n", strerror(errno));
+            exit(1);
+        }
+        c -> writes[pair]++;
+    }
+
+    exit(0);
+}
+
+// Reads each new message of the pair's channel (MSG_SLOT_NEWER) until stop, from cpu
+void pinned_consumer(char* path, int pair, int cpu, stress_counters* c){
+    int fd = open_channel(path, PINNED_CHANNEL_BASE + pair);
+    char buffer[64];
+
+    pin_to_cpu(cpu);
+
+    if(ioctl(fd, MSG_SLOT_FLAGS, MSG_SLOT_NEWER) < 0){
+        fprintf(stderr, "Error: ioctl(MSG_SLOT_FLAGS): %s\n", strerror(errno));
+        exit(1);
+    }
+
+    while(!c -> stop){
+        if(read(fd, buffer, sizeof(buffer)) < 0){
+            if(errno == EWOULDBLOCK)
+                continue;
+            fprintf(stderr, "Error: read: %s\n", strerror(errno));
+            exit(1);
+        }
+        c -> reads[pair]++;
+    }
+
+    exit(0);
+}
+
+// Prints the module's placement parameters, which the pinned benchmark is meant to compare
+void print_placement(void){
+    char* params[] = {"numa_place", "align_nodes"};
+
+    for(int i = 0; i < 2; i++){
+        char path[128], value[8] = "?";
+        snprintf(path, sizeof(path), "/sys/module/message_slot/parameters/%s", params[i]);
+
+        FILE* f = fopen(path, "r");
+        if(f != NULL){
+            if(fscanf(f, "%7s", value) != 1)
+                strcpy(value, "?");
+            fclose(f);
+        }
+
+        printf("%s=%s ", params[i], value);
+    }
+
+    printf("\n");
+}
+
+/*
+Pairs of a producer and a consumer of their own channel, the channels of all pairs neighbors (created one
+after the other). Producer i is pinned to cpu i and its consumer to cpu (cpus - 1 - i), so on a multi-socket
+machine they sit on different nodes. Reports the writes and the new messages read per second of each pair.
+Compare the module loaded with numa_place=1 align_nodes=1 against the defaults
+ */
+void bench_pinned(char* path, int max_pairs, int seconds){
+    stress_counters* c = mmap(NULL, sizeof(stress_counters), PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(c == MAP_FAILED){
+        fprintf(stderr, "Error: mmap: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    if(max_pairs > cpus / 2)
+        max_pairs = cpus / 2;
+    if(max_pairs > MAX_PROCS)
+        max_pairs = MAX_PROCS;
+
+    if(max_pairs < 1){
+        fprintf(stderr, "Error: the pinned benchmark needs at least 2 cpus\n");
+        exit(1);
+    }
+
+    print_placement();
+    printf("%8s %16s %16s\n", "pairs", "writes/s/pair", "reads/s/pair");
+
+    for(int pairs = 1; pairs <= max_pairs; pairs *= 2){
+        long long reads = 0, writes = 0;
+
+        memset(c, 0, sizeof(*c));
+        fflush(stdout);
+
+        for(int i = 0; i < 2 * pairs; i++){
+            pid_t pid = fork();
+
+            if(pid < 0){
+                fprintf(stderr, "Error: fork: %s\n", strerror(errno));
+                exit(1);
+            }
+
+            if(pid == 0){
+                if(i < pairs)
+                    pinned_producer(path, i, i, c);
+                else
+                    pinned_consumer(path, i - pairs, cpus - 1 - (i - pairs), c);
+            }
+        }
+
+        sleep(seconds);
+        c -> stop = 1;
+
+        for(int i = 0; i < 2 * pairs; i++)
+            wait(NULL);
+
+        for(int i = 0; i < pairs; i++){
+            reads += c -> reads[i];
+            writes += c -> writes[i];
+        }
+
+        printf("%8d %16.0f %16.0f\n", pairs, (double)writes / seconds / pairs, (double)reads / seconds / pairs);
+    }
+
+    munmap(c, sizeof(*c));
+}
+
+// ---------------------- fanout ---------------------- //
+
+// counters of a fanout run, shared by its reader processes
+typedef struct fanout_counters{
+    long long copies[MAX_PROCS];
+    long long seen[MAX_PROCS];
+}fanout_counters;
+
+// Follows the fanout channel until the writer's last message (index -1): re-reading it and comparing
+// each copy to the previous one, or (seq) waiting in MSG_SLOT_READ_SEQ for a newer one
+void fanout_reader(char* path, int id, bool seq, fanout_counters* c){
+    char buffer[BUF_LEN];
+    char last[BUF_LEN];
+    struct msg_slot_seq rs = {.buffer = (__u64)(unsigned long)buffer, .length = BUF_LEN};
+    int fd = open_channel(path, FANOUT_CHANNEL);
+    long long index = 0;
+    int last_bytes = 0;
+    int bytes;
+
+    if(seq && ioctl(fd, MSG_SLOT_FLAGS, MSG_SLOT_BLOCK) < 0){
+        fprintf(stderr, "Error: ioctl(MSG_SLOT_FLAGS): %s\n", strerror(errno));
+        exit(1);
+    }
+
+    while(index != -1){
+        if(seq){
+            bytes = ioctl(fd, MSG_SLOT_READ_SEQ, &rs) < 0 ? -1 : (int)rs.bytes;
+        }
+        else{
+            bytes = read(fd, buffer, BUF_LEN);
+        }
+
+        if(bytes < (int)sizeof(index)){
+            fprintf(stderr, "Error: reader %d: %s\n", id, strerror(errno));
+            exit(1);
+        }
+
+        c -> copies[id]++;
+
+        if(!seq && bytes == last_bytes && memcmp(buffer, last, bytes) == 0)
+            continue;
+
+        memcpy(last, buffer, bytes);
+        last_bytes = bytes;
+        memcpy(&index, buffer, sizeof(index));
+        c -> seen[id]++;
+    }
+
+    exit(0);
+}
+
+// Writes FANOUT_MESSAGES messages, one every FANOUT_INTERVAL_NS, and then the last one (index -1)
+void fanout_writer(int fd){
+    char buffer[64] = {0};
+    long long next = now_ns();
+
+    for(long long index = 1; index <= FANOUT_MESSAGES + 1; index++){
+        long long value = index <= FANOUT_MESSAGES ? index : -1;
+
+        while(now_ns() < next);
+        next += FANOUT_INTERVAL_NS;
+
+        memcpy(buffer, &value, sizeof(value));
+        if(write(fd, buffer, sizeof(buffer)) != sizeof(buffer)){
+            fprintf(stderr, "Error: write: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+}
+
+/*
+Several readers following one channel a writer updates every FANOUT_INTERVAL_NS: re-reading the channel
+and diffing each copy against the last one vs. MSG_SLOT_READ_SEQ, which only returns (and copies) a message
+the reader didn't see yet. Reports the copies each reader made per message it saw, and the readers' cpu time
+ */
+void bench_fanout(char* path, int fd, int readers){
+    fanout_counters* c = mmap(NULL, sizeof(fanout_counters), PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    struct rusage before, after;
+
+    if(c == MAP_FAILED){
+        fprintf(stderr, "Error: mmap: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    if(readers > MAX_PROCS)
+        readers = MAX_PROCS;
+
+    set_channel(fd, FANOUT_CHANNEL);
+
+    printf("%d readers, %d messages, one every %d us\n", readers, FANOUT_MESSAGES, FANOUT_INTERVAL_NS / 1000);
+    printf("%12s %16s %16s %16s\n", "mode", "copies/message", "seen/reader", "reader cpu s");
+
+    for(int mode = 0; mode < 2; mode++){
+        long long copies = 0, seen = 0;
+        long long zero = 0;
+        char first[64] = {0};
+
+        // a fresh message, so no reader mistakes what an earlier run left for the last one
+        memcpy(first, &zero, sizeof(zero));
+        if(write(fd, first, sizeof(first)) != sizeof(first)){
+            fprintf(stderr, "Error: write: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        memset(c, 0, sizeof(*c));
+        fflush(stdout);
+        getrusage(RUSAGE_CHILDREN, &before);
+
+        for(int i = 0; i < readers; i++){
+            pid_t pid = fork();
+
+            if(pid < 0){
+                fprintf(stderr, "Error: fork: %s\n", strerror(errno));
+                exit(1);
+            }
+
+            if(pid == 0)
+                fanout_reader(path, i, mode == 1, c);
+        }
+
+        fanout_writer(fd);
+
+        for(int i = 0; i < readers; i++)
+            wait(NULL);
+
+        getrusage(RUSAGE_CHILDREN, &after);
+
+        for(int i = 0; i < readers; i++){
+            copies += c -> copies[i];
+            seen += c -> seen[i];
+        }
+
+        printf("%12s %16.2f %16.0f %16.2f\n", mode == 1 ? "READ_SEQ" : "read + diff", (double)copies / seen,
+               (double)seen / readers,
+               (after.ru_utime.tv_sec - before.ru_utime.tv_sec + after.ru_stime.tv_sec - before.ru_stime.tv_sec) +
+               (after.ru_utime.tv_usec - before.ru_utime.tv_usec + after.ru_stime.tv_usec - before.ru_stime.tv_usec) / 1e6);
+    }
+
+    munmap(c, sizeof(*c));
+}
+
+void usage(char* prog){
+    fprintf(stderr, "usage: %s <message slot file> ioctl [max_channels (default 100000)]\n"
+                    "       %s <message slot file> stress [max_readers (default 16)] [seconds (default 3)]\n"
+                    "       %s <message slot file> rw [max_len (the module's max_msg_len, default 128)]\n"
+                    "       %s <message slot file> mmap [max_len (the module's max_msg_len, default 128)]\n"
+                    "       %s <message slot file> epoll [channels (default 500)]\n"
+                    "       %s <message slot file> queue [capacity (default 1024)]\n"
+                    "       %s <message slot file> vec [channels (default 24)]\n"
+                    "       %s <message slot file> fanout [readers (default 8)]\n"
+                    "       %s <message slot file> pinned [max_pairs (default cpus / 2)] [seconds (default 3)]\n",
+                    prog, prog, prog, prog, prog, prog, prog, prog, prog);
+    exit(1);
+}
+
+/**
+ * argv[1] = message slot file path (use a fresh minor: the channels it creates stay until unload)
+ * argv[2] = benchmark
+ * argv[3...] = benchmark arguments
+ */
+int main(int argc, char** argv){
+    if(argc < 3)
+        usage(argv[0]);
+
+    int fd = open(argv[1], O_RDWR);
+
+    if(fd < 0){
+        fprintf(stderr, "Error: couldn't open the given file at path: %s\n", argv[1]);
+        exit(1);
+    }
+
+    if(strcmp(argv[2], "ioctl") == 0)
+        bench_ioctl(fd, argc > 3 ? strtoul(argv[3], NULL, 10) : 100000);
+    else if(strcmp(argv[2], "rw") == 0)
+        bench_rw(fd, argc > 3 ? atoi(argv[3]) : BUF_LEN);
+    else if(strcmp(argv[2], "mmap") == 0)
+        bench_mmap(argv[1], fd, argc > 3 ? atoi(argv[3]) : BUF_LEN);
+    else if(strcmp(argv[2], "epoll") == 0)
+        bench_epoll(argv[1], argc > 3 ? atoi(argv[3]) : 500);
+    else if(strcmp(argv[2], "queue") == 0)
+        bench_queue(argv[1], argc > 3 ? atoi(argv[3]) : 1024);
+    else if(strcmp(argv[2], "vec") == 0)
+        bench_vec(fd, argc > 3 ? atoi(argv[3]) : 24);
+    else if(strcmp(argv[2], "fanout") == 0)
+        bench_fanout(argv[1], fd, argc > 3 ? atoi(argv[3]) : 8);
+    else if(strcmp(argv[2], "pinned") == 0)
+        bench_pinned(argv[1], argc > 3 ? atoi(argv[3]) : MAX_PROCS, argc > 4 ? atoi(argv[4]) : 3);
+    else if(strcmp(argv[2], "stress") == 0)
+        bench_stress(argv[1], argc > 3 ? atoi(argv[3]) : 16, argc > 4 ? atoi(argv[4]) : 3);
+    else
+        usage(argv[0]);
+
+    close(fd);
+    exit(0);
+}
+
+// gcc -O3 -Wall -std=c11 message_bench.c -o message_bench
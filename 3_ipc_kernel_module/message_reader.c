@@ -6,13 +6,135 @@
 #include <sys/ioctl.h>
 #include <errno.h>
 #include <zconf.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
 #include "message_slot.h"
+#include "stream_stats.h"
+
+#define STREAM_EVENTS 64
+
+static volatile sig_atomic_t stop;
+
+void on_signal(int sig){
+    stop = 1;
+}
+
+/**
+ * Streaming mode - reads the given channels until SIGINT / SIGTERM, or until max_messages messages
+ * were read (0 - no limit). Each channel gets a file with MSG_SLOT_NEWER, all polled with one epoll,
+ * so a message is read once however long it stays on its channel.
+ * Writes a record for each message to stdout: channel_id<TAB>length<TAB>message<NEWLINE>
+ * (the length frames messages that contain newlines). stdout is flushed whenever no message is waiting.
+ * @return the exit status - 1 if a channel failed
+ */
+int stream_channels(char* path, char** channels, int num_channels, long long max_messages){
+    struct epoll_event   events[STREAM_EVENTS];
+    struct sigaction     sa = { .sa_handler = on_signal };
+    unsigned long*       channel_ids = malloc(num_channels * sizeof(unsigned long));
+    int*                 fds = malloc(num_channels * sizeof(int));
+    char*                buffer = malloc(MAX_BUF_LEN);
+    int                  open_channels = num_channels;
+    stream_stats         stats;
+    long long            start;
+    int                  epoll_fd;
+    int                  ready;
+    int                  i;
+
+    if(channel_ids == NULL || fds == NULL || buffer == NULL || (epoll_fd = epoll_create1(0)) < 0){
+        fprintf(stderr, "Error: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    for(i = 0; i < num_channels; i++){
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = i };
+
+        channel_ids[i] = strtoul(channels[i], NULL, 10);
+        fds[i] = open(path, O_RDWR | O_NONBLOCK);
+
+        if(fds[i] < 0){
+            fprintf(stderr, "Error: couldn't open the given file at path: %s\n", path);
+            exit(1);
+        }
+
+        if(ioctl(fds[i], MSG_SLOT_CHANNEL, channel_ids[i]) < 0 || ioctl(fds[i], MSG_SLOT_FLAGS, MSG_SLOT_NEWER) < 0 ||
+           epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &ev) < 0){
+            fprintf(stderr, "Error: channel %s: %s\n", channels[i], strerror(errno));
+            exit(1);
+        }
+    }
+
+    // without SA_RESTART, so a signal ends epoll_wait
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    stats_init(&stats);
+
+    while(!stop && open_channels > 0 && (max_messages == 0 || stats.messages < max_messages)){
+        ready = epoll_wait(epoll_fd, events, STREAM_EVENTS, 0);
+
+        if(ready == 0){
+            fflush(stdout);
+            ready = epoll_wait(epoll_fd, events, STREAM_EVENTS, -1);
+        }
+
+        if(ready < 0){
+            if(errno == EINTR)
+                continue;
+            fprintf(stderr, "Error: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        for(int e = 0; e < ready && (max_messages == 0 || stats.messages < max_messages); e++){
+            i = events[e].data.u32;
+
+            start = now_ns();
+            int bytes_read = read(fds[i], buffer, MAX_BUF_LEN);
+
+            if(bytes_read < 0){
+                if(errno == EWOULDBLOCK || errno == EINTR)
+                    continue;
+
+                // e.g. the channel was deleted - the other channels go on
+                fprintf(stderr, "Error: channel %lu: %s\n", channel_ids[i], strerror(errno));
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fds[i], NULL);
+                stats.failed++;
+                open_channels--;
+                continue;
+            }
+
+            stats_add(&stats, now_ns() - start, 1, bytes_read);
+
+            printf("%lu\t%d\t", channel_ids[i], bytes_read);
+            fwrite(buffer, 1, bytes_read, stdout);
+            putchar('\n');
+        }
+    }
+
+    fflush(stdout);
+    stats_report(&stats, "message_reader", "read");
+
+    for(i = 0; i < num_channels; i++)
+        close(fds[i]);
+
+    close(epoll_fd);
+    free(buffer);
+    free(fds);
+    free(channel_ids);
+
+    return stats.failed > 0;
+}
 
 /**
  * argv[1] = message slot file path.
  * argv[2] = the target message channel id.
+ * Or, to stream several channels: argv[2] = -s, argv[3] = most messages to read (0 - until SIGINT / SIGTERM),
+ * argv[4...] = the channel ids.
  */
 int main(int argc, char** argv){
+    if(argc >= 5 && strcmp(argv[2], "-s") == 0)
+        exit(stream_channels(argv[1], argv + 4, argc - 4, atoll(argv[3])));
+
     if(argc != 3){
         fprintf(stderr, "Error: %s\n", strerror(EINVAL));
         exit(1);
@@ -34,20 +156,23 @@ int main(int argc, char** argv){
         exit(1);
     }
 
-    char buffer [BUF_LEN + 1];
+    // big enough for the largest message the module may be loaded to accept
+    char* buffer = malloc(MAX_BUF_LEN + 1);
+
+    if(buffer == NULL){
+        fprintf(stderr, "Error: %s\n", strerror(errno));
+        exit(1);
+    }
 
     // Read a message from the message slot file to a buffer
-    int bytes_read = read(fd, buffer, BUF_LEN);
+    int bytes_read = read(fd, buffer, MAX_BUF_LEN);
 
     if(bytes_read < 0){
         fprintf(stderr, "Error: %s\n", strerror(errno));
         exit(1);
     }
 
-    if(bytes_read <= BUF_LEN)
-        buffer[bytes_read] = '\0';
-    else
-        buffer[BUF_LEN] = '\0';
+    buffer[bytes_read] = '\0';
 
     // Close the device
     status = close(fd);
@@ -1,20 +1,167 @@
 #include <stdio.h>
 #include <asm/errno.h>
 #include <string.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <errno.h>
 #include <zconf.h>
+#include <unistd.h>
+#include <stdint.h>
 #include "message_slot.h"
+#include "stream_stats.h"
+
+// room for a whole record of the largest message, and many small ones
+#define STREAM_BUF_LEN (2 * MAX_BUF_LEN)
+
+typedef struct batch{
+    struct msg_slot_vec vecs[MSG_SLOT_MAX_VEC];
+    long long lines[MSG_SLOT_MAX_VEC];
+    unsigned int count;
+}batch;
+
+// Writes the batched records with a single MSG_SLOT_WRITE_VEC, reporting the ones that failed
+void flush_batch(int fd, batch* b, stream_stats* stats){
+    struct msg_slot_vecs   vecs = { .vecs = (__u64)(uintptr_t)b -> vecs, .count = b -> count };
+    long long              bytes = 0;
+    long long              sent = 0;
+    long long              start;
+
+    if(b -> count == 0)
+        return;
+
+    start = now_ns();
+
+    if(ioctl(fd, MSG_SLOT_WRITE_VEC, &vecs) < 0){
+        fprintf(stderr, "Error: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    for(unsigned int i = 0; i < b -> count; i++){
+        if(b -> vecs[i].result < 0){
+            fprintf(stderr, "Error: line %lld (channel %llu): %s\n", b -> lines[i],
+                    (unsigned long long)b -> vecs[i].channel_id, strerror(-b -> vecs[i].result));
+            stats -> failed++;
+            continue;
+        }
+        sent++;
+        bytes += b -> vecs[i].result;
+    }
+
+    stats_add(stats, now_ns() - start, sent, bytes);
+    b -> count = 0;
+}
+
+// Adds the record of a line (channel_id<TAB>payload, without its newline) to the batch
+void add_record(int fd, batch* b, char* line, size_t length, long long line_num, stream_stats* stats){
+    char*           tab = memchr(line, '\t', length);
+    char*           end;
+    unsigned long   channel_id;
+
+    if(tab != NULL){
+        *tab = '\0';
+        channel_id = strtoul(line, &end, 10);
+    }
+
+    if(tab == NULL || end == line || *end != '\0' || channel_id == 0){
+        fprintf(stderr, "Error: line %lld: not a channel_id<TAB>payload record\n", line_num);
+        stats -> failed++;
+        return;
+    }
+
+    b -> vecs[b -> count].channel_id = channel_id;
+    b -> vecs[b -> count].buffer = (__u64)(uintptr_t)(tab + 1);
+    b -> vecs[b -> count].length = length - (tab + 1 - line);
+    b -> lines[b -> count] = line_num;
+
+    if(++b -> count == MSG_SLOT_MAX_VEC)
+        flush_batch(fd, b, stats);
+}
+
+/**
+ * Streaming mode - writes a message for each channel_id<TAB>payload line of stdin, all through fd.
+ * The records of each chunk read from stdin go in MSG_SLOT_WRITE_VEC batches, so a busy stream costs
+ * about one ioctl per MSG_SLOT_MAX_VEC messages, and a record is written as soon as its line arrives.
+ * @return the exit status - 1 if any record failed
+ */
+int stream_records(int fd){
+    char*          buffer = malloc(STREAM_BUF_LEN);
+    batch*         b = calloc(1, sizeof(batch));
+    stream_stats   stats;
+    size_t         length = 0;
+    size_t         pos;
+    long long      line_num = 0;
+    ssize_t        bytes_read = 1;
+    char*          newline;
+
+    if(buffer == NULL || b == NULL){
+        fprintf(stderr, "Error: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    stats_init(&stats);
+
+    while(bytes_read > 0){
+        bytes_read = read(STDIN_FILENO, buffer + length, STREAM_BUF_LEN - length);
+
+        if(bytes_read < 0){
+            if(errno == EINTR){
+                bytes_read = 1;
+                continue;
+            }
+            fprintf(stderr, "Error: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        length += bytes_read;
+        pos = 0;
+
+        while(pos < length){
+            newline = memchr(buffer + pos, '\n', length - pos);
+
+            // a partial line waits for the rest of it, unless it's the last one
+            if(newline == NULL && bytes_read > 0){
+                if(pos == 0 && length == STREAM_BUF_LEN){
+                    fprintf(stderr, "Error: line %lld is longer than %d bytes\n", line_num + 1, STREAM_BUF_LEN);
+                    exit(1);
+                }
+                break;
+            }
+
+            if(newline == NULL)
+                newline = buffer + length;
+
+            add_record(fd, b, buffer + pos, newline - (buffer + pos), ++line_num, &stats);
+            pos = newline + 1 - buffer;
+        }
+
+        // the batch points into buffer, so it's written before buffer is reused
+        flush_batch(fd, b, &stats);
+
+        // keeping the partial line
+        length = pos < length ? length - pos : 0;
+        if(length > 0)
+            memmove(buffer, buffer + pos, length);
+    }
+
+    stats_report(&stats, "message_sender", "MSG_SLOT_WRITE_VEC");
+
+    free(b);
+    free(buffer);
+
+    return stats.failed > 0;
+}
 
 /**
  * argv[1] = message slot file path.
- * argv[2] = the target message channel id.
- * argv[3] = the message to pass.
+ * argv[2] = the target message channel id, or -s to stream channel_id<TAB>payload lines from stdin.
+ * argv[3] = the message to pass (not in streaming mode).
  */
 int main(int argc, char** argv){
-    if(argc != 4){
+    bool stream = argc == 3 && strcmp(argv[2], "-s") == 0;
+
+    if(argc != 4 && !stream){
         fprintf(stderr, "Error: %s\n", strerror(EINVAL));
         exit(1);
     }
@@ -27,6 +174,12 @@ int main(int argc, char** argv){
         exit(1);
     }
 
+    if(stream){
+        int status = stream_records(fd);
+        close(fd);
+        exit(status);
+    }
+
     // Set the channel id to the id specified on the command line
     int status = ioctl(fd, MSG_SLOT_CHANNEL, atoi(argv[2]));
 
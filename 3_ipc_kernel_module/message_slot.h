@@ -2,13 +2,120 @@
 #define EX3_MESSAGE_SLOT_H
 
 #include <linux/ioctl.h>
+#include <linux/types.h>
 
-// ioctl command option (the only one)
+// ioctl command options
+// set the channel of the file descriptor (arg - non zero channel id)
 #define MSG_SLOT_CHANNEL 101
+// set the flags of the file descriptor (arg - MSG_SLOT_BLOCK | MSG_SLOT_NEWER | MSG_SLOT_POSITIONAL, 0 by default)
+#define MSG_SLOT_FLAGS 102
+// switch the channel of the file descriptor to queue mode with room for arg messages
+// (up to MSG_SLOT_MAX_QUEUE), or back to keeping only the last message (arg - 0).
+// Changing the mode drops the channel's last message
+#define MSG_SLOT_QUEUE 103
+// read several queued messages of the channel (arg - struct msg_slot_batch*)
+#define MSG_SLOT_READ_BATCH _IOWR(MAJOR_NUM, 104, struct msg_slot_batch)
+// read a message of each of several channels (arg - struct msg_slot_vecs*)
+#define MSG_SLOT_READ_VEC _IOWR(MAJOR_NUM, 105, struct msg_slot_vecs)
+// write a message to each of several channels (arg - struct msg_slot_vecs*)
+#define MSG_SLOT_WRITE_VEC _IOWR(MAJOR_NUM, 106, struct msg_slot_vecs)
+// delete a channel of the file descriptor's message slot with its messages (arg - non zero channel id).
+// Files that still have it set fail their reads and writes with EIDRM until they set a channel again
+#define MSG_SLOT_DELETE 107
+// read the message of the file's channel with its sequence number, only if it's newer than the
+// caller's last seen one (arg - struct msg_slot_seq*)
+#define MSG_SLOT_READ_SEQ _IOWR(MAJOR_NUM, 108, struct msg_slot_seq)
+
+// read waits for a message instead of failing with EWOULDBLOCK (unless the file is O_NONBLOCK)
+#define MSG_SLOT_BLOCK 1
+// read only returns a message newer than the last one read through the file descriptor,
+// and poll reports the file readable only when there is one
+#define MSG_SLOT_NEWER 2
+// reads and writes address the channel whose id is their offset (pread / pwrite, or lseek),
+// instead of the file descriptor's channel. The offset isn't advanced. A write creates its channel,
+// a read of a channel that doesn't exist fails with EWOULDBLOCK
+#define MSG_SLOT_POSITIONAL 4
+
+#define MSG_SLOT_MAX_QUEUE 65536
+
+/*
+ * In queue mode a write appends a message to the channel's queue and a read consumes the oldest one.
+ * A write to a full queue fails with EAGAIN, or with MSG_SLOT_BLOCK waits until there's room.
+ * MSG_SLOT_READ_BATCH fills buffer with up to count queued messages, as records of the ring's
+ * format (a __u32 length followed by the message, padded to MSG_SLOT_RING_ALIGN bytes)
+ */
+struct msg_slot_batch{
+    __u64 buffer;   // user address of the records
+    __u32 length;   // size of buffer
+    __u32 count;    // in - most messages to read (0 - no limit), out - messages read
+    __u32 bytes;    // out - bytes of buffer filled
+    __u32 pad;
+};
+
+#define MSG_SLOT_MAX_VEC 1024
+
+/*
+ * An entry of MSG_SLOT_READ_VEC / MSG_SLOT_WRITE_VEC - a message of its own channel of the file's
+ * message slot, read or written like read() / write() of a file with that channel would
+ * (never waiting, and without setting the file's channel)
+ */
+struct msg_slot_vec{
+    __u64 channel_id;
+    __u64 buffer;   // user address of the message
+    __u32 length;   // read - size of buffer, write - bytes of the message
+    __s32 result;   // out - bytes read / written, or -errno
+};
+
+struct msg_slot_vecs{
+    __u64 vecs;     // user address of count struct msg_slot_vec
+    __u32 count;    // up to MSG_SLOT_MAX_VEC
+    __u32 pad;
+};
+
+/*
+ * Every write to a channel gives its message the channel's next sequence number (1, 2, ...).
+ * MSG_SLOT_READ_SEQ returns the message of the file's channel (in queue mode the oldest queued one,
+ * taking it off the queue) only if its seq is more than the given one, OW fails with EWOULDBLOCK,
+ * or with MSG_SLOT_BLOCK waits until there's one. A reader passes the seq it got last (0 at first),
+ * so any number of readers can follow a channel and copy each message once. A deleted and
+ * re-created channel starts over from 1
+ */
+struct msg_slot_seq{
+    __u64 buffer;   // user address of the message
+    __u64 seq;      // in - last seq seen (0 - none), out - the message's seq
+    __u32 length;   // size of buffer
+    __u32 bytes;    // out - bytes of the message
+};
 
 #define MAJOR_NUM 240
 #define DEVICE_RANGE_NAME "message_slot"
+// default maximum message size (the module's max_msg_len parameter)
 #define BUF_LEN 128
+// the largest max_msg_len the module accepts - a buffer this big can hold any message
+#define MAX_BUF_LEN (256 * 1024)
 #define DEVICE_FILE_NAME "message_slot"
 
+/*
+ * Shared ring of a channel - mmap a message slot file (with a channel set) at offset 0.
+ * The first MSG_SLOT_RING_DATA bytes are a msg_slot_ring header and the data area of size bytes
+ * (the module's ring_size, a power of 2) follows it. Map MSG_SLOT_RING_DATA bytes first to
+ * learn the size, then the whole ring. The module only writes size, it never reads it back.
+ *
+ * A record is a __u32 length followed by the message, padded to MSG_SLOT_RING_ALIGN bytes.
+ * head and tail are free running byte counts, their offset in the data area is & (size - 1).
+ * One producer writes a record at head and then advances head (store-release), one consumer
+ * reads the record at tail and then advances tail (store-release). The ring is independent
+ * of the message read() and write() return.
+ */
+struct msg_slot_ring{
+    __u64 head;
+    __u8  head_pad[56];
+    __u64 tail;
+    __u8  tail_pad[56];
+    __u32 size;
+};
+
+#define MSG_SLOT_RING_DATA 4096
+#define MSG_SLOT_RING_ALIGN 8
+
 #endif
@@ -0,0 +1,1266 @@
+#undef __KERNEL__
+#define __KERNEL__
+#undef MODULE
+#define MODULE
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/string.h>
+#include <linux/kdev_t.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/xarray.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/overflow.h>
+#include <linux/uio.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/hash.h>
+#include <linux/jiffies.h>
+#include <linux/workqueue.h>
+#include <linux/sched.h>
+#include "message_slot.h"
+#include "channel_store.h"
+
+MODULE_LICENSE("GPL");
+
+// the largest message a write may publish
+static unsigned int max_msg_len = BUF_LEN;
+module_param(max_msg_len, uint, 0444);
+MODULE_PARM_DESC(max_msg_len, "maximum message size in bytes, up to 262144 (default 128)");
+
+// size of the data area of a channel's shared ring
+static unsigned int ring_size = 1 << 20;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "bytes in each channel's mmap ring, a power of 2 from 4096 to 64M (default 1M)");
+
+// caps of the memory the channels of a minor / of all minors hold, 0 for no cap (see channel_store.h)
+module_param(max_slot_bytes, ulong, 0644);
+MODULE_PARM_DESC(max_slot_bytes, "most bytes of channels and messages per minor, 0 for no cap (default 0)");
+
+module_param(max_total_bytes, ulong, 0644);
+MODULE_PARM_DESC(max_total_bytes, "most bytes of channels and messages of all minors, 0 for no cap (default 0)");
+
+// placement of channel state (see channel_store.h)
+module_param(numa_place, bool, 0644);
+MODULE_PARM_DESC(numa_place, "allocate a channel's messages on the NUMA node of its first writer (default N)");
+
+module_param(align_nodes, bool, 0444);
+MODULE_PARM_DESC(align_nodes, "cache-line-align channels, so hot neighboring channels don't share a line (default N)");
+
+// seconds a channel may go without a write before it's deleted, 0 to keep channels
+static unsigned int channel_ttl;
+module_param(channel_ttl, uint, 0444);
+MODULE_PARM_DESC(channel_ttl, "delete channels that weren't written for this many seconds, 0 to keep them (default 0)");
+
+/**
+        -------------------------------------- Main Ideas --------------------------------------
+
+ - An array for all 256 possible minors = 256 different message slots files.
+ - Each entry at the array is a slot, which indexes its channels by channel id in an xarray,
+   so finding a channel doesn't depend on how many channels the slot has.
+ - The channels themselves (the xarray, nodes, messages, queues and their locking) are the slot's
+   channel store, in channel_store.c. This file is the device around it: files, ioctls, rings and counters.
+ - Each node at the xarray is a different channel id in his message slots file.
+ - Each file will hold its current channel id (if selected), by pointing to the appropriate node at the xarray
+   (each node has a channel_id field), together with its read flags and the sequence number of the
+   last message it read
+ - With MSG_SLOT_POSITIONAL a file addresses channels by the offset of each read / write (pread, pwrite)
+   instead of by its channel, and keeps the channels it used lately in a small cache, so one file can
+   talk to many channels without an ioctl per switch.
+ - Every message published on a channel gets the next sequence number of the channel. Readers that
+   wait for a message (blocking reads and poll) sleep on the channel's wait queue, and a write wakes them
+ - A channel in queue mode (MSG_SLOT_QUEUE) also has a bounded ring of messages. Writes append to it
+   and reads consume from it, in order. Writers that wait for room sleep on the same wait queue
+
+         -------------------------------------- Concurrency --------------------------------------
+
+ - A message is never modified once it's published on a channel. A write builds a new message
+   and swaps it in under the channel's lock, so writers serialize per channel only.
+ - Readers take no lock: under rcu_read_lock they take a reference to the channel's current
+   message, and copy it out after rcu_read_unlock. A message is freed (after an RCU grace period)
+   when the channel and all the readers copying it dropped their references, so a reader
+   always copies a whole message, never a torn one.
+ - A channel holds only its id, its lock and a pointer to its message, so an idle channel costs a
+   few dozen bytes. Messages are allocated by their size: from one of the size class caches
+   (64B - 4KB objects) for small messages, and with kvmalloc (pages) for large ones, so the
+   maximum message size (max_msg_len) can be raised up to MAX_BUF_LEN without making small messages bigger.
+   With numa_place they're allocated on the NUMA node of the channel's first writer, and with align_nodes
+   channels start on their own cache line, so a producer and a consumer on other sockets don't bounce
+   the lines of a neighboring channel.
+ - A channel may also have a shared ring (see message_slot.h), made by its first mmap.
+   Producers and consumers move the ring's indices in user space, so the module never copies
+   its messages. The ring is vmalloc-ed, and it lives as long as the channel's node (which its mappings hold).
+ - The queue of a channel is only touched under the channel's lock. Its messages are copied
+   out after they were taken off the queue, so a reader owns the message it copies.
+ - Each slot counts its opens, channel switches, reads, writes, bytes and errors in per-CPU counters,
+   so counting never shares a cache line between CPUs. debugfs message_slot/stats sums them per minor.
+   The data path only logs with pr_debug (off unless enabled by dynamic debug).
+ - Channels are inserted with xa_insert, so two ioctls creating the same channel on a minor
+   agree on a single node.
+ - A node is reference counted: the xarray holds one reference, and so does every file that has it
+   set (or cached, or polled while a poll may still wait on it) and every mapping of its ring. Others take a reference under rcu_read_lock,
+   and a node is freed an RCU grace period after its last reference is put.
+ - Deleting a channel (MSG_SLOT_DELETE, or when it wasn't written for channel_ttl seconds) takes it
+   out of the xarray, marks it dead, drops its messages and wakes its waiters. Files that still
+   reference it get EIDRM, and a later ioctl of the same id makes a new node.
+ - Each slot (and the module) counts the bytes its nodes, messages, queues and rings hold.
+   A write, a new channel or a queue that would pass max_slot_bytes or max_total_bytes fails with EDQUOT.
+
+         -------------------------------------- Main Functions --------------------------------------
+
+ - device_open     -       Creating a new slot if message_slots[minor] == NULL, and the file's context
+ - device_ioctl    -    1) Creating a new node for the given channel id (if it wasn't created yet)
+                        2) Setting the file's channel to point the appropriate node
+                           (which holds the given channel id)
+                           Or setting the file's read flags (MSG_SLOT_FLAGS), its channel's mode
+                           (MSG_SLOT_QUEUE) or reading a batch of queued messages (MSG_SLOT_READ_BATCH)
+                           Or reading / writing a message of each of several channels (MSG_SLOT_*_VEC)
+                           Or deleting a channel (MSG_SLOT_DELETE)
+ - device_write_iter -     Publishing the given data as the appropriate node's message, or queueing it
+                           (in according to the current channel id)
+ - device_read_iter  -     Reading the message of the appropriate node, or consuming its oldest queued one
+                           (in according to the current channel id)
+ - device_mmap     -       Mapping the shared ring of the appropriate node (making it if needed)
+ - device_poll     -       Reporting whether the appropriate node has a message to read
+ - evict_channels  -       Deleting the channels that weren't written for channel_ttl seconds (every channel_ttl / 2)
+ */
+
+// Data structure for the 256 different message slots - array of slots
+
+// most messages a batch read takes off a queue under one hold of the channel's lock
+#define BATCH_CHUNK 16
+
+// bytes of a message's record in a batch read buffer
+#define MSG_RECORD_LEN(bytes) ALIGN(sizeof(__u32) + (bytes), MSG_SLOT_RING_ALIGN)
+
+#define FD_CACHE_BITS 3
+#define FD_CACHE_SIZE (1 << FD_CACHE_BITS)
+
+// most channels a file's polls may wait on at once (see pin_node)
+#define FD_MAX_PINS 64
+
+// struct for an open message slot file (its private data)
+typedef struct file_ctx{
+
+    // the slot of the file's minor
+    struct slot* slot;
+
+    // the channel set on the file, NULL if none
+    node* channel;
+
+    // MSG_SLOT_BLOCK | MSG_SLOT_NEWER | MSG_SLOT_POSITIONAL
+    unsigned int flags;
+
+    // sequence number of the last message read through the file
+    unsigned long last_seq;
+
+    // channels positional reads and writes used lately, by the hash of their id
+    node* cache[FD_CACHE_SIZE];
+
+    // channels polls of the file may still wait on, referenced while someone waits on them.
+    // The lock is held from pinning a channel until the poll is on its wait queue
+    struct node_pin* pins;
+    unsigned int num_pins;
+    struct mutex lock;
+}file_ctx;
+
+typedef struct node_pin{
+    node* n;
+    struct node_pin* next;
+}node_pin;
+
+// struct for a slot in our array of message slots - its channels and counters
+typedef struct slot{
+    channel_store store;
+    struct slot_stats __percpu* stats;
+}slot;
+
+// struct for the counters of a slot - one per CPU, summed when they're read (debugfs message_slot/stats)
+typedef struct slot_stats{
+    u64 opens;
+    u64 channel_switches;
+    u64 reads;
+    u64 writes;
+    u64 bytes_read;
+    u64 bytes_written;
+
+    // failed reads, writes and ioctls
+    u64 errors;
+}slot_stats;
+
+#define count_stat(s, field) this_cpu_inc((s) -> stats -> field)
+#define add_stat(s, field, n) this_cpu_add((s) -> stats -> field, n)
+
+// message_slots array - entry for each minor
+slot* message_slots [256];
+
+static struct dentry* debugfs_dir;
+
+static void evict_channels(struct work_struct* work);
+static DECLARE_DELAYED_WORK(evict_work, evict_channels);
+
+//================== WAITING ====================================
+
+// Returns whether reads and writes of the file wait (MSG_SLOT_BLOCK without O_NONBLOCK or nowait)
+static bool should_block(struct file* file, bool nowait){
+    return (READ_ONCE(((file_ctx*)file -> private_data) -> flags) & MSG_SLOT_BLOCK) &&
+           !(file -> f_flags & O_NONBLOCK) && !nowait;
+}
+
+// Returns the sequence number a message read through the file has to pass (MSG_SLOT_NEWER), NULL if any will do
+static const unsigned long* newer_than(file_ctx* ctx){
+    return (READ_ONCE(ctx -> flags) & MSG_SLOT_NEWER) ? &ctx -> last_seq : NULL;
+}
+
+
+//================== NODES ======================================
+
+/**
+ * Drops the file's pins of channels no one waits on anymore (their epoll entries were removed, or their polls returned),
+ * so switching channels doesn't keep every channel the file ever polled. A pin of a channel that others wait on stays.
+ * Called with ctx -> lock held, so no poll of the file is between pinning a channel and waiting on it
+ */
+static void unpin_idle_nodes(file_ctx* ctx){
+    node_pin**  link = &ctx -> pins;
+    node_pin*   pin;
+
+    while((pin = *link) != NULL){
+        if(wq_has_sleeper(&pin -> n -> waiters)){
+            link = &pin -> next;
+            continue;
+        }
+
+        *link = pin -> next;
+        ctx -> num_pins--;
+        put_node(pin -> n);
+        kfree(pin);
+    }
+}
+
+/**
+ * Keeps a reference to the node while the file's polls may wait on it, since a poll of the file (an epoll set's
+ * above all) may wait on the node's wait queue after the file's channel changed. Called with ctx -> lock held
+ * @return 0 on success. OW, error value (-EMFILE if the file waits on FD_MAX_PINS channels already).
+ */
+static int pin_node(file_ctx* ctx, node* n){
+    node_pin*   pin;
+
+    for(pin = ctx -> pins; pin != NULL && pin -> n != n; pin = pin -> next);
+
+    if(pin != NULL)
+        return 0;
+
+    if(ctx -> num_pins >= FD_MAX_PINS)
+        unpin_idle_nodes(ctx);
+
+    if(ctx -> num_pins >= FD_MAX_PINS){
+        pr_debug("device_poll - ERROR: the file waits on %d channels already\n", FD_MAX_PINS);
+        return -EMFILE;
+    }
+
+    pin = kmalloc(sizeof(node_pin), GFP_KERNEL);
+
+    if(!pin)
+        return -ENOMEM;
+
+    refcount_inc(&n -> refs);
+    pin -> n = n;
+    pin -> next = ctx -> pins;
+    ctx -> pins = pin;
+    ctx -> num_pins++;
+
+    return 0;
+}
+
+//================== DEVICE FUNCTIONS ===========================
+
+static int device_open(struct inode* inode, struct file* file){
+    unsigned int minor_num;
+    slot*        new_slot;
+    file_ctx*    ctx;
+
+    if(inode == NULL || file == NULL){
+        pr_debug("device_open - ERROR: NULL arg at device_open\n");
+        return -EINVAL;
+    }
+
+    pr_debug("device_open - Invoking device_open(%p)\n", file);
+
+    minor_num = iminor(inode);
+    pr_debug("device_open - minor# = %d\n", minor_num);
+
+    // check if the given minor# has a slot in our array, and if not make one
+    if(READ_ONCE(message_slots[minor_num]) == NULL){
+        new_slot = kmalloc(sizeof(slot), GFP_KERNEL);
+
+        if(!new_slot){
+            pr_debug("device_open - ERROR: kmalloc failed\n");
+            return -ENOMEM;
+        }
+
+        init_store(&new_slot -> store);
+        new_slot -> stats = alloc_percpu(slot_stats);
+
+        if(!new_slot -> stats){
+            pr_debug("device_open - ERROR: alloc_percpu failed\n");
+            kfree(new_slot);
+            return -ENOMEM;
+        }
+
+        // another open of the same minor may have made one meanwhile
+        if(cmpxchg(&message_slots[minor_num], NULL, new_slot) != NULL){
+            free_percpu(new_slot -> stats);
+            kfree(new_slot);
+        }
+    }
+
+    ctx = kzalloc(sizeof(file_ctx), GFP_KERNEL);
+
+    if(!ctx){
+        pr_debug("device_open - ERROR: kzalloc failed\n");
+        return -ENOMEM;
+    }
+
+    ctx -> slot = READ_ONCE(message_slots[minor_num]);
+    mutex_init(&ctx -> lock);
+    file -> private_data = ctx;
+    count_stat(ctx -> slot, opens);
+
+    return 0;
+}
+
+static int device_release (struct inode* inode, struct file* file){
+    file_ctx*   ctx;
+    node_pin*   pin;
+    int         i;
+
+    if(inode == NULL || file == NULL){
+        pr_debug("device_release - ERROR: NULL arg at device_release\n");
+        return -EINVAL;
+    }
+
+    pr_debug("device_release - Invoking device_release(%p,%p)\n", inode, file);
+
+    // putting the file's references to its channels
+    ctx = file -> private_data;
+    set_node(&ctx -> channel, NULL);
+
+    for(i = 0; i < FD_CACHE_SIZE; i++)
+        set_node(&ctx -> cache[i], NULL);
+
+    while(ctx -> pins != NULL){
+        pin = ctx -> pins;
+        ctx -> pins = pin -> next;
+        put_node(pin -> n);
+        kfree(pin);
+    }
+
+    kfree(ctx);
+
+    return 0;
+}
+
+//================== CHANNELS ===================================
+
+/**
+ * Drops the file's cache entries of deleted channels (MSG_SLOT_DELETE, or evicted), so their nodes aren't held
+ * (nor counted against the caps) until the entry is replaced or the file is released
+ */
+static void drop_dead_cached(file_ctx* ctx){
+    node*   n;
+    int     i;
+
+    for(i = 0; i < FD_CACHE_SIZE; i++){
+        n = READ_ONCE(ctx -> cache[i]);
+
+        // a concurrent lookup may have replaced the entry meanwhile - then it's the new entry's
+        if(n != NULL && READ_ONCE(n -> dead) && cmpxchg(&ctx -> cache[i], n, NULL) == n)
+            put_node(n);
+    }
+}
+
+/**
+ * Returns the channel a read or write of the file at pos addresses, with a reference the caller has to put:
+ * with MSG_SLOT_POSITIONAL the channel whose id is pos (looked up in the file's cache first, and created
+ * by a write if it doesn't exist - a read of a missing channel fails with EWOULDBLOCK), OW the file's channel
+ * @return the node on success, NULL if no channel has been set on the file. OW, ERR_PTR of the error value.
+ */
+static node* io_channel(file_ctx* ctx, loff_t pos, bool write){
+    node**  cached;
+    node*   n;
+
+    if(!(READ_ONCE(ctx -> flags) & MSG_SLOT_POSITIONAL))
+        return get_node(&ctx -> channel);
+
+    if(pos <= 0)
+        return ERR_PTR(-EINVAL);
+
+    // nodes never change their id, so an entry is valid if it holds the right one (and wasn't deleted)
+    cached = &ctx -> cache[hash_long(pos, FD_CACHE_BITS)];
+    n = get_node(cached);
+
+    if(n != NULL && n -> channel_id == pos && !READ_ONCE(n -> dead))
+        return n;
+
+    if(n != NULL){
+        put_node(n);
+        drop_dead_cached(ctx);
+    }
+
+    // reads don't create channels, so probing offsets doesn't allocate (and charge) nodes
+    if(write){
+        n = get_channel(&ctx -> slot -> store, pos);
+    }
+    else{
+        n = find_channel(&ctx -> slot -> store, pos);
+        if(n == NULL)
+            return ERR_PTR(-EWOULDBLOCK);
+    }
+
+    // the cache entry holds a reference of its own
+    if(!IS_ERR(n)){
+        refcount_inc(&n -> refs);
+        set_node(cached, n);
+    }
+
+    return n;
+}
+
+//================== CHANNEL I/O ================================
+
+/**
+ * Reads the last message written on the channel into the user's buffers (read or readv),
+ * or in queue mode consumes the oldest queued message (a message that can't be copied out is lost).
+ * With MSG_SLOT_NEWER only a message newer than the last one read through the file counts,
+ * with MSG_SLOT_BLOCK (and without O_NONBLOCK or IOCB_NOWAIT) waits for a message if there is none
+ * @return On success: number of bytes read. OW, error value.
+ */
+static ssize_t channel_read_iter(struct kiocb* iocb, struct iov_iter* to){
+    struct file*   file;
+    file_ctx*      ctx;
+    node*          n;
+    message*       msg;
+    size_t         length;
+    int            bytes_read;
+    int            err;
+
+    if(iocb == NULL || to == NULL || iocb -> ki_filp == NULL){
+        pr_debug("device_read - ERROR: NULL arg at device_read_iter\n");
+        return -EINVAL;
+    }
+
+    file = iocb -> ki_filp;
+    ctx = file -> private_data;
+    n = io_channel(ctx, iocb -> ki_pos, false);
+    length = iov_iter_count(to);
+
+    // checking if a channel has been set on the file
+    if(IS_ERR_OR_NULL(n)){
+        pr_debug("device_read - ERROR: no channel has been set on the file descriptor, or no channel at the offset\n");
+        return n == NULL ? -EINVAL : PTR_ERR(n);
+    }
+
+    // positional reads don't track the messages the file read - each channel would need its own
+    if(READ_ONCE(ctx -> flags) & MSG_SLOT_POSITIONAL)
+        ctx = NULL;
+
+    // checking if a message has been set on the channel (a newer one, with MSG_SLOT_NEWER),
+    // or in queue mode if one is queued, and if it fits in the provided buffers
+    err = take_message(n, ctx != NULL ? newer_than(ctx) : NULL, length, should_block(file, iocb -> ki_flags & IOCB_NOWAIT), &msg);
+    put_node(n);
+
+    if(err){
+        pr_debug("device_read - ERROR: no message to read, or the provided buffer length is too small (%d)\n", err);
+        return err;
+    }
+
+    // reading the message
+    pr_debug("device_read - Invoking device_read_iter(%p,%ld)\n", file, length);
+
+    bytes_read = msg -> bytes;
+
+    if(copy_to_iter(msg -> data, bytes_read, to) != bytes_read){
+        pr_debug("device_read - ERROR: copy_to_iter failed\n");
+        put_message(msg);
+        return -EFAULT;
+    }
+
+    if(ctx != NULL)
+        WRITE_ONCE(ctx -> last_seq, msg -> seq);
+    put_message(msg);
+
+    return bytes_read;
+}
+
+/**
+ * Writes a non-empty message of up to max_msg_len bytes, gathered from the user's buffers (write or writev)
+ * (possibly contains something different than a C string).
+ * In queue mode a write to a full queue fails with -EAGAIN, or with MSG_SLOT_BLOCK waits for room
+ * @return On success: number of bytes written. OW, error value.
+ */
+static ssize_t channel_write_iter(struct kiocb* iocb, struct iov_iter* from){
+    struct file*   file;
+    node*          n;
+    unsigned long  file_cid;
+    message*       msg;
+    size_t         length;
+    int            bytes_written;
+    int            err;
+
+    if(iocb == NULL || from == NULL || iocb -> ki_filp == NULL){
+        pr_debug("device_write - ERROR: NULL arg at device_write_iter\n");
+        return -EINVAL;
+    }
+
+    file = iocb -> ki_filp;
+    length = iov_iter_count(from);
+
+    if(length == 0 || length > max_msg_len){
+        pr_debug("device_write - ERROR: passed message size is 0 or more than %u\n", max_msg_len);
+        return -EMSGSIZE;
+    }
+
+    n = io_channel(file -> private_data, iocb -> ki_pos, true);
+
+    // checking if no channel has been set on the fd
+    if(IS_ERR_OR_NULL(n)){
+        pr_debug("device_write - ERROR: no channel has been set on the file descriptor, or no channel at the offset\n");
+        return n == NULL ? -EINVAL : PTR_ERR(n);
+    }
+
+    file_cid = n -> channel_id;
+    pr_debug("device_write - file_cid = %lu\n", file_cid);
+
+    msg = new_message(n, length);
+
+    if(IS_ERR(msg)){
+        pr_debug("device_write - ERROR: message allocation failed, or the memory cap is reached\n");
+        put_node(n);
+        return PTR_ERR(msg);
+    }
+
+    // writing the message
+    pr_debug("device_write - Invoking device_write_iter (%p,%ld)\n", file, length);
+
+    // the message is only published once it was fully copied, so a failed write leaves the channel as is
+    if(!copy_from_iter_full(msg -> data, length, from)){
+        pr_debug("device_write - ERROR: copy_from_iter failed\n");
+        drop_message(n -> store, msg);
+        put_node(n);
+        return -EFAULT;
+    }
+
+    bytes_written = length;
+
+    // in queue mode, appending it (or waiting for room) instead of replacing the last message
+    err = post_message(n, msg, should_block(file, iocb -> ki_flags & IOCB_NOWAIT));
+    put_node(n);
+
+    return err ? err : bytes_written;
+}
+
+static ssize_t device_read_iter(struct kiocb* iocb, struct iov_iter* to){
+    slot*     s = ((file_ctx*)iocb -> ki_filp -> private_data) -> slot;
+    ssize_t   ret = channel_read_iter(iocb, to);
+
+    if(ret < 0){
+        count_stat(s, errors);
+    }
+    else{
+        count_stat(s, reads);
+        add_stat(s, bytes_read, ret);
+    }
+
+    return ret;
+}
+
+static ssize_t device_write_iter(struct kiocb* iocb, struct iov_iter* from){
+    slot*     s = ((file_ctx*)iocb -> ki_filp -> private_data) -> slot;
+    ssize_t   ret = channel_write_iter(iocb, from);
+
+    if(ret < 0){
+        count_stat(s, errors);
+    }
+    else{
+        count_stat(s, writes);
+        add_stat(s, bytes_written, ret);
+    }
+
+    return ret;
+}
+
+/**
+ * Returns the channel's shared ring, making it if it has none
+ * @return the ring on success. OW, ERR_PTR of the error value.
+ */
+static struct msg_slot_ring* get_ring(node* n){
+    struct msg_slot_ring* ring = READ_ONCE(n -> ring);
+
+    if(ring != NULL)
+        return ring;
+
+    if(charge(n -> store, MSG_SLOT_RING_DATA + ring_size))
+        return ERR_PTR(-EDQUOT);
+
+    // zeroed - both indices start at 0
+    ring = vmalloc_user(MSG_SLOT_RING_DATA + ring_size);
+
+    if(ring == NULL){
+        uncharge(n -> store, MSG_SLOT_RING_DATA + ring_size);
+        return ERR_PTR(-ENOMEM);
+    }
+
+    ring -> size = ring_size;
+
+    // what put_node uncharges. A racing get_ring sets the same
+    WRITE_ONCE(n -> ring_bytes, MSG_SLOT_RING_DATA + ring_size);
+
+    // another mmap of the channel may have made one meanwhile
+    if(cmpxchg(&n -> ring, NULL, ring) != NULL){
+        vfree(ring);
+        uncharge(n -> store, MSG_SLOT_RING_DATA + ring_size);
+        ring = READ_ONCE(n -> ring);
+    }
+
+    return ring;
+}
+
+// Each mapping of a ring holds a reference to its node, so the ring outlives neither the node nor the mapping
+static void ring_vm_open(struct vm_area_struct* vma){
+    refcount_inc(&((node*)vma -> vm_private_data) -> refs);
+}
+
+static void ring_vm_close(struct vm_area_struct* vma){
+    put_node(vma -> vm_private_data);
+}
+
+static const struct vm_operations_struct ring_vm_ops = {
+        .open  = ring_vm_open,
+        .close = ring_vm_close,
+};
+
+/**
+ * Maps (a prefix of) the shared ring of the channel set on the file
+ * @return 0 on success. OW, error value.
+ */
+static int device_mmap(struct file* file, struct vm_area_struct* vma){
+    struct msg_slot_ring* ring;
+    node*                 n;
+    int                   err;
+
+    if(file == NULL || vma == NULL){
+        pr_debug("device_mmap - ERROR: NULL arg at device_mmap\n");
+        return -EINVAL;
+    }
+
+    if(vma -> vm_pgoff != 0 || vma -> vm_end - vma -> vm_start > MSG_SLOT_RING_DATA + ring_size){
+        pr_debug("device_mmap - ERROR: the mapping isn't a prefix of the ring\n");
+        return -EINVAL;
+    }
+
+    n = get_node(&((file_ctx*)file -> private_data) -> channel);
+
+    if(n == NULL){
+        pr_debug("device_mmap - ERROR: no channel has been set on the file descriptor\n");
+        return -EINVAL;
+    }
+
+    ring = READ_ONCE(n -> dead) ? ERR_PTR(-EIDRM) : get_ring(n);
+
+    if(IS_ERR(ring)){
+        pr_debug("device_mmap - ERROR: the channel was deleted, or making its ring failed\n");
+        put_node(n);
+        return PTR_ERR(ring);
+    }
+
+    err = remap_vmalloc_range(vma, ring, 0);
+
+    if(err){
+        put_node(n);
+        return err;
+    }
+
+    // the mapping takes over our reference
+    vma -> vm_private_data = n;
+    vma -> vm_ops = &ring_vm_ops;
+
+    return 0;
+}
+
+/**
+ * Reports the file writable unless its channel's queue is full, and readable when its channel has a message to read (by the file's flags).
+ * A file waits on the wait queue of the channel it had when it was added to the poll/epoll set,
+ * so the channel should be set before that. A deleted channel reports EPOLLERR, and so does waiting on
+ * more than FD_MAX_PINS channels through one file at once
+ */
+static __poll_t device_poll(struct file* file, poll_table* wait){
+    file_ctx*      ctx = file -> private_data;
+    node*          n = get_node(&ctx -> channel);
+    __poll_t       mask = 0;
+
+    if(n == NULL)
+        return EPOLLERR;
+
+    // the poll may outlast the file's reference to the channel
+    if(!poll_does_not_wait(wait)){
+        mutex_lock(&ctx -> lock);
+
+        if(pin_node(ctx, n)){
+            mutex_unlock(&ctx -> lock);
+            put_node(n);
+            return EPOLLERR;
+        }
+
+        poll_wait(file, &n -> waiters, wait);
+        mutex_unlock(&ctx -> lock);
+    }
+
+    if(READ_ONCE(n -> dead)){
+        put_node(n);
+        return EPOLLERR;
+    }
+
+    if(has_room(n))
+        mask |= EPOLLOUT | EPOLLWRNORM;
+
+    if(has_message(n, newer_than(ctx)))
+        mask |= EPOLLIN | EPOLLRDNORM;
+
+    put_node(n);
+
+    return mask;
+}
+
+/**
+ * Fills the user's msg_slot_batch buffer with the oldest queued messages of the channel,
+ * taking them off the queue a chunk at a time. With MSG_SLOT_BLOCK waits until there's at least one
+ * @return 0 on success. OW, error value.
+ */
+static long read_batch(struct file* file, node* n, struct msg_slot_batch __user* user_batch){
+    struct msg_slot_batch  batch;
+    message*               msgs[BATCH_CHUNK];
+    msg_queue*             q;
+    char __user*           buffer;
+    unsigned int           max_count;
+    unsigned int           taken;
+    unsigned int           pending;
+    unsigned int           queued;
+    unsigned int           i;
+    bool                   dead;
+    long                   err = 0;
+
+    if(copy_from_user(&batch, user_batch, sizeof(batch)) != 0)
+        return -EFAULT;
+
+    buffer = u64_to_user_ptr(batch.buffer);
+    max_count = batch.count ? batch.count : U32_MAX;
+    batch.count = 0;
+    batch.bytes = 0;
+
+    while(batch.count < max_count){
+        taken = 0;
+        pending = batch.bytes;
+
+        spin_lock(&n -> lock);
+        q = n -> queue;
+
+        while(q != NULL && q -> count > 0 && taken < BATCH_CHUNK && batch.count + taken < max_count &&
+              pending + MSG_RECORD_LEN(q -> msgs[q -> head] -> bytes) <= batch.length){
+            msgs[taken++] = q -> msgs[q -> head];
+            pending += MSG_RECORD_LEN(q -> msgs[q -> head] -> bytes);
+            q -> head = (q -> head + 1) % q -> capacity;
+            q -> count--;
+        }
+
+        // the queue may be replaced (or the channel deleted) once the lock is dropped
+        dead = n -> dead;
+        queued = q != NULL ? q -> count : 0;
+        spin_unlock(&n -> lock);
+
+        if(taken == 0){
+            // a batch returns what it got so far rather than wait for more
+            if(batch.count > 0)
+                break;
+
+            if(dead){
+                pr_debug("device_ioctl - ERROR: the channel was deleted\n");
+                return -EIDRM;
+            }
+
+            if(q == NULL){
+                pr_debug("device_ioctl - ERROR: the channel isn't in queue mode\n");
+                return -EINVAL;
+            }
+
+            if(queued > 0){
+                pr_debug("device_ioctl - ERROR: the oldest queued message doesn't fit in the batch buffer\n");
+                return -ENOSPC;
+            }
+
+            if(!should_block(file, false))
+                return -EWOULDBLOCK;
+
+            if(wait_event_interruptible(n -> waiters, has_message(n, newer_than(file -> private_data))))
+                return -ERESTARTSYS;
+
+            continue;
+        }
+
+        if(wq_has_sleeper(&n -> waiters))
+            wake_up_interruptible_poll(&n -> waiters, EPOLLOUT | EPOLLWRNORM);
+
+        // the messages are ours now - copying them out as records (a message that faults is lost)
+        for(i = 0; i < taken; i++){
+            if(err == 0 && (put_user((__u32)msgs[i] -> bytes, (__u32 __user*)(buffer + batch.bytes)) ||
+                            copy_to_user(buffer + batch.bytes + sizeof(__u32), msgs[i] -> data, msgs[i] -> bytes))){
+                err = -EFAULT;
+            }
+
+            if(err == 0){
+                count_stat(((file_ctx*)file -> private_data) -> slot, reads);
+                add_stat(((file_ctx*)file -> private_data) -> slot, bytes_read, msgs[i] -> bytes);
+                batch.bytes += MSG_RECORD_LEN(msgs[i] -> bytes);
+                batch.count++;
+                WRITE_ONCE(((file_ctx*)file -> private_data) -> last_seq, msgs[i] -> seq);
+            }
+
+            drop_message(n -> store, msgs[i]);
+        }
+
+        if(err)
+            return err;
+    }
+
+    if(copy_to_user(user_batch, &batch, sizeof(batch)) != 0)
+        return -EFAULT;
+
+    return 0;
+}
+
+/**
+ * Copies the channel's message to the user's msg_slot_seq buffer with its sequence number, only if it's newer
+ * than the seq the user passed (MSG_SLOT_READ_SEQ). With MSG_SLOT_BLOCK waits for one.
+ * The caller keeps the seq it saw last instead of the file, so a reader that has the message doesn't copy it again.
+ * The file's last_seq follows too, so poll with MSG_SLOT_NEWER agrees
+ * @return 0 on success. OW, error value.
+ */
+static long read_seq(struct file* file, node* n, struct msg_slot_seq __user* user_seq){
+    struct msg_slot_seq   rs;
+    file_ctx*             ctx = file -> private_data;
+    unsigned long         last_seq;
+    message*              msg;
+    int                   err;
+
+    if(copy_from_user(&rs, user_seq, sizeof(rs)) != 0)
+        return -EFAULT;
+
+    last_seq = rs.seq;
+    err = take_message(n, &last_seq, rs.length, should_block(file, false), &msg);
+
+    if(err){
+        pr_debug("device_ioctl - ERROR: no newer message to read, or the provided buffer length is too small (%d)\n", err);
+        return err;
+    }
+
+    if(copy_to_user(u64_to_user_ptr(rs.buffer), msg -> data, msg -> bytes) != 0){
+        put_message(msg);
+        return -EFAULT;
+    }
+
+    rs.seq = msg -> seq;
+    rs.bytes = msg -> bytes;
+    WRITE_ONCE(ctx -> last_seq, msg -> seq);
+    count_stat(ctx -> slot, reads);
+    add_stat(ctx -> slot, bytes_read, msg -> bytes);
+    put_message(msg);
+
+    if(copy_to_user(user_seq, &rs, sizeof(rs)) != 0)
+        return -EFAULT;
+
+    return 0;
+}
+
+/**
+ * Reads (write == false) or writes the messages of an array of msg_slot_vec, each on its own channel
+ * of the file's slot, without waiting and without changing the file's channel.
+ * Each entry gets its own result - a read consumes (in queue mode) or copies the channel's message,
+ * a write queues or publishes one. A read of a channel that doesn't exist gets -EWOULDBLOCK
+ * @return 0 on success (even if entries failed). OW, error value.
+ */
+static long rw_vec(slot* s, struct msg_slot_vecs __user* user_vecs, bool write){
+    struct msg_slot_vecs   vecs;
+    struct msg_slot_vec    v;
+    struct msg_slot_vec __user* entry;
+    message*               msg;
+    node*                  n;
+    unsigned int           i;
+    int                    result;
+
+    if(copy_from_user(&vecs, user_vecs, sizeof(vecs)) != 0)
+        return -EFAULT;
+
+    if(vecs.count > MSG_SLOT_MAX_VEC){
+        pr_debug("rw_vec - ERROR: more than %d entries\n", MSG_SLOT_MAX_VEC);
+        return -EINVAL;
+    }
+
+    entry = u64_to_user_ptr(vecs.vecs);
+
+    for(i = 0; i < vecs.count; i++, entry++){
+        if(copy_from_user(&v, entry, sizeof(v)) != 0)
+            return -EFAULT;
+
+        if(v.channel_id == 0){
+            result = -EINVAL;
+        }
+        // checked before get_channel, so a bad entry doesn't create (and charge) a channel
+        else if(write && (v.length == 0 || v.length > max_msg_len)){
+            result = -EMSGSIZE;
+        }
+        else if(write){
+            n = get_channel(&s -> store, v.channel_id);
+
+            if(IS_ERR(n)){
+                result = PTR_ERR(n);
+            }
+            else{
+                if(IS_ERR(msg = new_message(n, v.length))){
+                    result = PTR_ERR(msg);
+                }
+                else if(copy_from_user(msg -> data, u64_to_user_ptr(v.buffer), v.length) != 0){
+                    drop_message(&s -> store, msg);
+                    result = -EFAULT;
+                }
+                else{
+                    result = post_message(n, msg, false);
+                    result = result ? result : v.length;
+                }
+
+                put_node(n);
+            }
+        }
+        else{
+            n = find_channel(&s -> store, v.channel_id);
+
+            if(n == NULL){
+                result = -EWOULDBLOCK;
+            }
+            else{
+                if((result = take_message(n, NULL, v.length, false, &msg)) == 0){
+                    result = msg -> bytes;
+                    if(copy_to_user(u64_to_user_ptr(v.buffer), msg -> data, msg -> bytes) != 0)
+                        result = -EFAULT;
+                    put_message(msg);
+                }
+
+                put_node(n);
+            }
+        }
+
+        if(result < 0){
+            count_stat(s, errors);
+        }
+        else if(write){
+            count_stat(s, writes);
+            add_stat(s, bytes_written, result);
+        }
+        else{
+            count_stat(s, reads);
+            add_stat(s, bytes_read, result);
+        }
+
+        if(put_user(result, &entry -> result))
+            return -EFAULT;
+    }
+
+    return 0;
+}
+
+/**
+ * Supports the ioctl commands:
+ *   MSG_SLOT_CHANNEL    - sets the file's channel, @param ioctl_param - non zero channel id
+ *   MSG_SLOT_FLAGS      - sets the file's flags, @param ioctl_param - MSG_SLOT_BLOCK | MSG_SLOT_NEWER | MSG_SLOT_POSITIONAL
+ *   MSG_SLOT_QUEUE      - sets the mode of the file's channel, @param ioctl_param - queue capacity, 0 for none
+ *   MSG_SLOT_READ_BATCH - reads queued messages of the file's channel, @param ioctl_param - struct msg_slot_batch*
+ *   MSG_SLOT_READ_VEC   - reads a message of each given channel, @param ioctl_param - struct msg_slot_vecs*
+ *   MSG_SLOT_WRITE_VEC  - writes a message to each given channel, @param ioctl_param - struct msg_slot_vecs*
+ *   MSG_SLOT_DELETE     - deletes a channel of the file's slot, @param ioctl_param - non zero channel id
+ *   MSG_SLOT_READ_SEQ   - reads a message newer than a given seq, @param ioctl_param - struct msg_slot_seq*
+ * @return 0 on success. OW, error value.
+ */
+static long channel_ioctl(struct file* file, unsigned int ioctl_command_id, unsigned long ioctl_param){
+    unsigned int   minor_num;
+    slot*          tmp_message_slot;
+    node*          tmp_node;
+    file_ctx*      ctx = file -> private_data;
+    long           ret;
+
+    if(ioctl_command_id == MSG_SLOT_FLAGS){
+        if(ioctl_param & ~(unsigned long)(MSG_SLOT_BLOCK | MSG_SLOT_NEWER | MSG_SLOT_POSITIONAL)){
+            pr_debug("device_ioctl - ERROR: unknown flags\n");
+            return -EINVAL;
+        }
+
+        WRITE_ONCE(ctx -> flags, ioctl_param);
+        return 0;
+    }
+
+    if(ioctl_command_id == MSG_SLOT_QUEUE || ioctl_command_id == MSG_SLOT_READ_BATCH ||
+       ioctl_command_id == MSG_SLOT_READ_SEQ){
+        if(ioctl_command_id == MSG_SLOT_QUEUE && ioctl_param > MSG_SLOT_MAX_QUEUE){
+            pr_debug("device_ioctl - ERROR: queue capacity is more than %d\n", MSG_SLOT_MAX_QUEUE);
+            return -EINVAL;
+        }
+
+        tmp_node = get_node(&ctx -> channel);
+
+        if(tmp_node == NULL){
+            pr_debug("device_ioctl - ERROR: no channel has been set on the file descriptor\n");
+            return -EINVAL;
+        }
+
+        if(ioctl_command_id == MSG_SLOT_READ_BATCH)
+            ret = read_batch(file, tmp_node, (struct msg_slot_batch __user*)ioctl_param);
+        else if(ioctl_command_id == MSG_SLOT_READ_SEQ)
+            ret = read_seq(file, tmp_node, (struct msg_slot_seq __user*)ioctl_param);
+        else
+            ret = set_queue(tmp_node, ioctl_param);
+
+        put_node(tmp_node);
+
+        return ret;
+    }
+
+    if(ioctl_command_id != MSG_SLOT_CHANNEL && ioctl_command_id != MSG_SLOT_READ_VEC &&
+       ioctl_command_id != MSG_SLOT_WRITE_VEC && ioctl_command_id != MSG_SLOT_DELETE){
+        pr_debug("device_ioctl - ERROR: ioctl_command_id is invalid\n");
+        return -EINVAL;
+    }
+
+    if(ioctl_param == 0){
+        pr_debug("device_ioctl - ERROR: ioctl_param is 0\n");
+        return -EINVAL;
+    }
+
+    minor_num = iminor(file -> f_path.dentry -> d_inode);
+    pr_debug("device_ioctl - minor_num = %d\n", minor_num);
+
+    // checking if the message slot file exists
+    tmp_message_slot = READ_ONCE(message_slots[minor_num]);
+
+    if(tmp_message_slot == NULL){
+        pr_debug("device_ioctl - ERROR: file wasn't opened\n");
+        return -EINVAL;
+    }
+
+    if(ioctl_command_id == MSG_SLOT_DELETE){
+        ret = delete_channel(&tmp_message_slot -> store, ioctl_param);
+        drop_dead_cached(ctx);
+        return ret;
+    }
+
+    if(ioctl_command_id != MSG_SLOT_CHANNEL)
+        return rw_vec(tmp_message_slot, (struct msg_slot_vecs __user*)ioctl_param,
+                      ioctl_command_id == MSG_SLOT_WRITE_VEC);
+
+    // finding the channel, or creating it if it doesn't exist
+    tmp_node = get_channel(&tmp_message_slot -> store, ioctl_param);
+
+    if(IS_ERR(tmp_node))
+        return PTR_ERR(tmp_node);
+
+    // set the current channel id - no message of it was read through the file yet.
+    // The file takes over the reference get_channel took
+    WRITE_ONCE(ctx -> last_seq, 0);
+    set_node(&ctx -> channel, tmp_node);
+    count_stat(tmp_message_slot, channel_switches);
+
+    // the channels the file stopped waiting on are no longer held (nor counted against the caps)
+    mutex_lock(&ctx -> lock);
+    unpin_idle_nodes(ctx);
+    mutex_unlock(&ctx -> lock);
+
+    return 0;
+}
+
+static long device_ioctl(struct file* file, unsigned int ioctl_command_id, unsigned long ioctl_param){
+    long   ret = channel_ioctl(file, ioctl_command_id, ioctl_param);
+
+    if(ret < 0)
+        count_stat(((file_ctx*)file -> private_data) -> slot, errors);
+
+    return ret;
+}
+
+//==================== EVICTION =================================
+
+// Deletes the idle channels of all slots, every channel_ttl / 2 seconds
+static void evict_channels(struct work_struct* work){
+    slot*   s;
+    int     minor_num;
+
+    for(minor_num = 0; minor_num < 256; minor_num++){
+        s = READ_ONCE(message_slots[minor_num]);
+
+        if(s != NULL)
+            evict_idle(&s -> store, (unsigned long)channel_ttl * HZ);
+    }
+
+    schedule_delayed_work(&evict_work, max((unsigned long)channel_ttl * HZ / 2, 1UL));
+}
+
+//==================== STATISTICS ===============================
+
+// Prints the summed counters of each minor that has been opened
+static int stats_show(struct seq_file* m, void* unused){
+    slot_stats   sum;
+    slot_stats*  st;
+    slot*        s;
+    int          minor_num;
+    int          cpu;
+
+    seq_printf(m, "%5s %9s %14s %12s %12s %14s %14s %16s %16s %12s\n", "minor", "channels", "bytes", "opens",
+               "switches", "reads", "writes", "bytes_read", "bytes_written", "errors");
+
+    for(minor_num = 0; minor_num < 256; minor_num++){
+        s = READ_ONCE(message_slots[minor_num]);
+
+        if(s == NULL)
+            continue;
+
+        memset(&sum, 0, sizeof(sum));
+
+        for_each_possible_cpu(cpu){
+            st = per_cpu_ptr(s -> stats, cpu);
+            sum.opens += READ_ONCE(st -> opens);
+            sum.channel_switches += READ_ONCE(st -> channel_switches);
+            sum.reads += READ_ONCE(st -> reads);
+            sum.writes += READ_ONCE(st -> writes);
+            sum.bytes_read += READ_ONCE(st -> bytes_read);
+            sum.bytes_written += READ_ONCE(st -> bytes_written);
+            sum.errors += READ_ONCE(st -> errors);
+        }
+
+        seq_printf(m, "%5d %9d %14ld %12llu %12llu %14llu %14llu %16llu %16llu %12llu\n", minor_num,
+                   atomic_read(&s -> store.num_of_nodes), atomic_long_read(&s -> store.bytes), sum.opens,
+                   sum.channel_switches, sum.reads, sum.writes, sum.bytes_read, sum.bytes_written, sum.errors);
+    }
+
+    seq_printf(m, "total bytes %ld\n", atomic_long_read(&total_bytes));
+
+    return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+//==================== DEVICE SETUP =============================
+
+// This structure will hold the functions to be called
+// when a process does something to the device we created
+struct file_operations Fops =
+        {
+                .owner	        = THIS_MODULE,
+                .llseek         = default_llseek,
+                .read_iter      = device_read_iter,
+                .write_iter     = device_write_iter,
+                .open           = device_open,
+                .unlocked_ioctl = device_ioctl,
+                .mmap           = device_mmap,
+                .poll           = device_poll,
+                .release        = device_release,
+        };
+
+// Initialize the module - Register the character device
+static int simple_init(void){
+    int   status;
+    int   i;
+
+    printk("-----------------------------------------------------------------\n");
+
+    if(max_msg_len == 0 || max_msg_len > MAX_BUF_LEN){
+        printk(KERN_ERR "max_msg_len must be between 1 and %d\n", MAX_BUF_LEN);
+        return -EINVAL;
+    }
+
+    if(!is_power_of_2(ring_size) || ring_size < PAGE_SIZE || ring_size > (64 << 20)){
+        printk(KERN_ERR "ring_size must be a power of 2 between %lu and %d\n", PAGE_SIZE, 64 << 20);
+        return -EINVAL;
+    }
+
+    status = store_init();
+
+    if(status < 0){
+        printk(KERN_ERR "creating the message caches failed\n");
+        return status;
+    }
+
+    status = register_chrdev(MAJOR_NUM, DEVICE_RANGE_NAME, &Fops);
+
+    if(status < 0){
+        printk(KERN_ERR "%s registration failed for %d\n", DEVICE_FILE_NAME, MAJOR_NUM);
+        store_exit();
+        return status;
+    }
+
+    printk( "Registration is successful.\n");
+
+    // the counters are only for monitoring, so the module works without them
+    debugfs_dir = debugfs_create_dir("message_slot", NULL);
+    debugfs_create_file("stats", 0444, debugfs_dir, NULL, &stats_fops);
+
+    for(i = 0; i < 256; i++){
+        message_slots[i] = NULL;
+    }
+
+    if(channel_ttl > 0)
+        schedule_delayed_work(&evict_work, max((unsigned long)channel_ttl * HZ / 2, 1UL));
+
+    return 0;
+}
+
+// Frees the slot and its channels, one by one (no file is open and no ring is mapped by now)
+void free_slot(slot* s){
+    destroy_store(&s -> store);
+    free_percpu(s -> stats);
+    kfree(s);
+}
+
+static void __exit simple_cleanup(void){
+    int   i;
+
+    cancel_delayed_work_sync(&evict_work);
+    debugfs_remove_recursive(debugfs_dir);
+
+    for(i = 0; i < 256; i++){
+        if(message_slots[i] != NULL){
+            free_slot(message_slots[i]);
+        }
+    }
+
+    unregister_chrdev(MAJOR_NUM, DEVICE_RANGE_NAME);
+
+    // wait for the messages and nodes that are still on their way to be freed
+    rcu_barrier();
+    store_exit();
+
+    printk("unloaded module message_slot\n");
+    printk("-----------------------------------------------------------------\n");
+}
+
+module_init(simple_init);
+module_exit(simple_cleanup);
@@ -0,0 +1,357 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include "channel_store.h"
+
+/*
+Multi-threaded benchmark of the channel store (channel_store.c), built for userspace with
+channel_store_user.c - no module needed. Each workload runs with 1, 2, 4 ... up to -t threads
+for -d ms and reports the operations per second of all threads together.
+Run it before and after any change to the lookup, locking or copy paths of the store
+(make store_bench).
+ */
+
+// ---------------------- workers ---------------------- //
+
+typedef struct worker{
+    pthread_t thread;
+    int id;
+    long long ops;
+}worker;
+
+static channel_store store;
+static volatile int stop;
+static int (*work)(worker* w, unsigned int* seed);
+static unsigned long num_channels = 100000;
+static unsigned int msg_len = 64;
+static bool pin;
+
+long long now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Spreads the i-th channel id over 32 bits (a bijection, so ids never repeat) and never 0
+unsigned long channel_of(unsigned long i){
+    return (unsigned long)(unsigned int)((i + 1) * 2654435761u);
+}
+
+// Pins even workers to the first cpus and odd ones to the last, so the two workers of a pair run apart
+void pin_worker(worker* w){
+    int         cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int         cpu = w -> id % 2 == 0 ? (w -> id / 2) % cpus : cpus - 1 - (w -> id / 2) % cpus;
+    cpu_set_t   set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+void* run_worker(void* arg){
+    worker*        w = arg;
+    unsigned int   seed = w -> id * 7919 + 1;
+
+    if(pin)
+        pin_worker(w);
+
+    while(!stop){
+        if(work(w, &seed) < 0){
+            fprintf(stderr, "Error: an operation of worker %d failed\n", w -> id);
+            exit(1);
+        }
+        w -> ops++;
+    }
+
+    rcu_thread_exit();
+
+    return NULL;
+}
+
+// Runs work on threads threads for ms milliseconds. Returns the operations per second of all of them
+double run_threads(int threads, int ms){
+    worker*     workers = calloc(threads, sizeof(worker));
+    long long   ops = 0;
+    long long   start;
+
+    if(workers == NULL){
+        fprintf(stderr, "Error: calloc() failed.\n");
+        exit(1);
+    }
+
+    stop = 0;
+    start = now_ns();
+
+    for(int i = 0; i < threads; i++){
+        workers[i].id = i;
+        if(pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0){
+            fprintf(stderr, "Error: pthread_create() failed.\n");
+            exit(1);
+        }
+    }
+
+    usleep(ms * 1000);
+    stop = 1;
+
+    for(int i = 0; i < threads; i++){
+        pthread_join(workers[i].thread, NULL);
+        ops += workers[i].ops;
+    }
+
+    free(workers);
+
+    return ops * 1e9 / (now_ns() - start);
+}
+
+void run_workload(char* title, int max_threads, int ms){
+    printf("%s\n", title);
+
+    for(int threads = 1; threads <= max_threads; threads *= 2)
+        printf("  %3d threads: %12.0f ops/s\n", threads, run_threads(threads, ms));
+}
+
+// ---------------------- workloads ---------------------- //
+
+// finds a random one of num_channels existing channels
+int lookup_op(worker* w, unsigned int* seed){
+    node* n = find_channel(&store, channel_of(rand_r(seed) % num_channels));
+
+    if(n == NULL)
+        return -1;
+
+    put_node(n);
+    return 0;
+}
+
+// writes and reads a msg_len message on the thread's own channel
+int private_op(worker* w, unsigned int* seed){
+    char       buffer[MAX_BUF_LEN];
+    node*      n = get_channel(&store, channel_of(w -> id));
+    message*   msg;
+    int        err;
+
+    if(IS_ERR(n))
+        return -1;
+
+    msg = new_message(n, msg_len);
+    if(IS_ERR(msg)){
+        put_node(n);
+        return -1;
+    }
+
+    memset(msg -> data, w -> id, msg_len);
+    err = post_message(n, msg, false);
+
+    if(err == 0 && (err = take_message(n, NULL, sizeof(buffer), false, &msg)) == 0){
+        memcpy(buffer, msg -> data, msg -> bytes);
+        put_message(msg);
+    }
+
+    put_node(n);
+    return err;
+}
+
+// every thread writes (1 in 8 ops) and reads one shared channel
+int shared_op(worker* w, unsigned int* seed){
+    char       buffer[MAX_BUF_LEN];
+    node*      n = find_channel(&store, channel_of(0));
+    message*   msg;
+    int        err = 0;
+
+    if(n == NULL)
+        return -1;
+
+    if(rand_r(seed) % 8 == 0){
+        msg = new_message(n, msg_len);
+        if(IS_ERR(msg)){
+            put_node(n);
+            return -1;
+        }
+        memset(msg -> data, w -> id, msg_len);
+        err = post_message(n, msg, false);
+    }
+    else if((err = take_message(n, NULL, sizeof(buffer), false, &msg)) == 0){
+        memcpy(buffer, msg -> data, msg -> bytes);
+        put_message(msg);
+    }
+
+    put_node(n);
+    return err;
+}
+
+// even threads write and odd ones read the channel of their pair - the pairs' channels were created one after the other
+int pairs_op(worker* w, unsigned int* seed){
+    char       buffer[MAX_BUF_LEN];
+    node*      n = find_channel(&store, channel_of(w -> id / 2));
+    message*   msg;
+    int        err;
+
+    if(n == NULL)
+        return -1;
+
+    if(w -> id % 2 == 0){
+        msg = new_message(n, msg_len);
+        if(IS_ERR(msg)){
+            put_node(n);
+            return -1;
+        }
+        memset(msg -> data, w -> id, msg_len);
+        err = post_message(n, msg, false);
+    }
+    else if((err = take_message(n, NULL, sizeof(buffer), false, &msg)) == 0){
+        memcpy(buffer, msg -> data, msg -> bytes);
+        put_message(msg);
+    }
+
+    put_node(n);
+    return err == -EWOULDBLOCK ? 0 : err;
+}
+
+// creates a channel of the thread's own and deletes it
+int churn_op(worker* w, unsigned int* seed){
+    unsigned long   channel_id = channel_of(num_channels + w -> id);
+    node*           n = get_channel(&store, channel_id);
+
+    if(IS_ERR(n))
+        return -1;
+
+    put_node(n);
+    return delete_channel(&store, channel_id);
+}
+
+// Creates the channels, with a message on the first one (the shared channel)
+void fill_store(void){
+    message*  msg;
+    node*     n;
+
+    for(unsigned long i = 0; i < num_channels; i++){
+        n = get_channel(&store, channel_of(i));
+        if(IS_ERR(n)){
+            fprintf(stderr, "Error: get_channel() failed: %s\n", strerror(-PTR_ERR(n)));
+            exit(1);
+        }
+
+        if(i == 0){
+            msg = new_message(n, msg_len);
+            if(IS_ERR(msg) || post_message(n, msg, false) != 0){
+                fprintf(stderr, "Error: writing the shared channel failed\n");
+                exit(1);
+            }
+        }
+
+        put_node(n);
+    }
+}
+
+void usage(char* prog){
+    fprintf(stderr, "usage: %s <workload> [options]\n"
+                    "workloads:\n"
+                    "  lookup   finding one of the channels\n"
+                    "  private  a write and a read of each thread's own channel\n"
+                    "  shared   reads (7/8) and writes (1/8) of a single channel\n"
+                    "  churn    creating and deleting a channel\n"
+                    "  pairs    a writer and a reader of each pair's channel, the channels neighbors\n"
+                    "  all      all of the above\n"
+                    "options:\n"
+                    "  -t  most threads (default the number of cpus)\n"
+                    "  -c  channels in the store (default 100000)\n"
+                    "  -l  message length (default 64)\n"
+                    "  -d  ms per run (default 1000)\n"
+                    "  -p  pin the threads of a pair to cpus far apart (first and last)\n"
+                    "  -a  cache-line-align channels (align_nodes)\n", prog);
+    exit(1);
+}
+
+/**
+ * argv[1] = workload, followed by its options
+ */
+int main(int argc, char** argv){
+    int    max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int    ms = 1000;
+    char*  workload;
+    int    opt;
+
+    if(argc < 2)
+        usage(argv[0]);
+
+    workload = argv[1];
+    optind = 2;
+    while((opt = getopt(argc, argv, "t:c:l:d:pa")) != -1){
+        switch(opt){
+            case 't':
+                max_threads = atoi(optarg);
+                break;
+            case 'c':
+                num_channels = strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                msg_len = atoi(optarg);
+                break;
+            case 'd':
+                ms = atoi(optarg);
+                break;
+            case 'p':
+                pin = true;
+                break;
+            case 'a':
+                align_nodes = true;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if(max_threads <= 0 || num_channels == 0 || msg_len == 0 || msg_len > MAX_BUF_LEN || ms <= 0)
+        usage(argv[0]);
+
+    if(strcmp(workload, "lookup") != 0 && strcmp(workload, "private") != 0 && strcmp(workload, "shared") != 0 &&
+       strcmp(workload, "churn") != 0 && strcmp(workload, "pairs") != 0 && strcmp(workload, "all") != 0)
+        usage(argv[0]);
+
+    if(store_init() != 0){
+        fprintf(stderr, "Error: store_init() failed.\n");
+        exit(1);
+    }
+
+    init_store(&store);
+    fill_store();
+
+    if(strcmp(workload, "lookup") == 0 || strcmp(workload, "all") == 0){
+        work = lookup_op;
+        run_workload("lookup", max_threads, ms);
+    }
+
+    if(strcmp(workload, "private") == 0 || strcmp(workload, "all") == 0){
+        work = private_op;
+        run_workload("private channel write + read", max_threads, ms);
+    }
+
+    if(strcmp(workload, "shared") == 0 || strcmp(workload, "all") == 0){
+        work = shared_op;
+        run_workload("shared channel 7 reads : 1 write", max_threads, ms);
+    }
+
+    if(strcmp(workload, "churn") == 0 || strcmp(workload, "all") == 0){
+        work = churn_op;
+        run_workload("channel create + delete", max_threads, ms);
+    }
+
+    if(strcmp(workload, "pairs") == 0 || strcmp(workload, "all") == 0){
+        work = pairs_op;
+        run_workload("pairs of a writer and a reader", max_threads, ms);
+    }
+
+    destroy_store(&store);
+    rcu_barrier();
+    store_exit();
+
+    return 0;
+}
+
+// make store_bench, or:
+// gcc -O2 -Wall -std=gnu11 -pthread store_bench.c channel_store.c channel_store_user.c -o store_bench
@@ -0,0 +1,374 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "channel_store.h"
+
+/*
+Fuzz harness of the channel store (channel_store.c), built for userspace with channel_store_user.c.
+Threads run random operations - creating, finding, writing, reading, deleting and evicting channels,
+switching them to and from queue mode - on a small range of channel ids, so they keep racing each other,
+under a memory cap. It checks that:
+ - every operation fails only with the errors it may fail with
+ - a message is read whole (its bytes follow the pattern it was written with), and within the read's length
+ - a read of only newer messages (MSG_SLOT_NEWER, MSG_SLOT_READ_SEQ) gets a newer one, in queue mode too,
+   and leaves a queued message that isn't newer on the queue
+ - switching a channel into or out of queue mode drops its last message, so it never comes back
+ - a new channel is counted, and once everything is deleted, no byte is counted and no node or message is left
+Exits with 1 on the first failure. Build it with make store_fuzz (with AddressSanitizer).
+ */
+
+#define HELD 4
+#define MAX_FUZZ_LEN 1024
+
+typedef struct fuzzer{
+    pthread_t thread;
+    unsigned int seed;
+
+    // nodes the thread references, like files that have them set
+    node* held[HELD];
+    unsigned long last_seq[HELD];
+
+    long long ops;
+    long long messages;
+}fuzzer;
+
+static channel_store store;
+static long long ops_per_thread = 200000;
+static unsigned long channel_ids = 64;
+
+void fail(char* what, int err){
+    fprintf(stderr, "Error: %s (%d)\n", what, err);
+    exit(1);
+}
+
+// Checks a message read of up to length bytes was written whole by write_op
+void check_message(message* msg, size_t length){
+    if(msg -> bytes <= 0 || msg -> bytes > length || msg -> bytes > MAX_FUZZ_LEN)
+        fail("read a message of a wrong length", msg -> bytes);
+
+    for(int i = 1; i < msg -> bytes; i++){
+        if((unsigned char)msg -> data[i] != (unsigned char)(msg -> data[0] + i * 7))
+            fail("read a torn message", i);
+    }
+}
+
+// Returns a held node (a reference the caller puts), or a channel found by id. NULL if neither exists
+node* pick_node(fuzzer* f, int k, unsigned long channel_id){
+    node* n = get_node(&f -> held[k]);
+
+    return n != NULL ? n : find_channel(&store, channel_id);
+}
+
+void write_op(fuzzer* f, node* n){
+    size_t     length = 1 + rand_r(&f -> seed) % MAX_FUZZ_LEN;
+    message*   msg = new_message(n, length);
+    int        err;
+
+    if(IS_ERR(msg)){
+        if(PTR_ERR(msg) != -EDQUOT)
+            fail("new_message failed", PTR_ERR(msg));
+        return;
+    }
+
+    msg -> data[0] = rand_r(&f -> seed);
+    for(int i = 1; i < length; i++)
+        msg -> data[i] = msg -> data[0] + i * 7;
+
+    err = post_message(n, msg, false);
+
+    if(err != 0 && err != -EAGAIN && err != -EIDRM)
+        fail("post_message failed", err);
+}
+
+void read_op(fuzzer* f, node* n, int k, bool newer){
+    size_t     length = 1 + rand_r(&f -> seed) % MAX_FUZZ_LEN;
+    message*   msg;
+    int        err;
+
+    err = take_message(n, newer ? &f -> last_seq[k] : NULL, length, false, &msg);
+
+    if(err == -EWOULDBLOCK || err == -ENOSPC || err == -EIDRM)
+        return;
+
+    if(err != 0)
+        fail("take_message failed", err);
+
+    check_message(msg, length);
+
+    if(newer && msg -> seq <= f -> last_seq[k])
+        fail("a newer read got an old message", (int)msg -> seq);
+
+    f -> last_seq[k] = msg -> seq;
+    f -> messages++;
+    put_message(msg);
+}
+
+// Checks a newer read of a queue with messages 1 and 2 on a channel of its own: past 2 it gets none, and the queue keeps both
+void check_queue_seq(void){
+    node*           n = get_channel(&store, channel_ids + 1);
+    message*        msg;
+    unsigned long   last_seq = 2;
+    unsigned int    count = 0;
+    unsigned int    capacity;
+    int             err;
+
+    if(IS_ERR(n))
+        fail("get_channel failed", PTR_ERR(n));
+
+    // the first channel of the store, counted as debugfs shows it whether or not pr_debug is on
+    if(atomic_read(&store.num_of_nodes) != 1)
+        fail("a new channel wasn't counted", atomic_read(&store.num_of_nodes));
+
+    if((err = set_queue(n, 4)) != 0)
+        fail("set_queue failed", err);
+
+    for(int i = 0; i < 2; i++){
+        msg = new_message(n, 1);
+        if(IS_ERR(msg))
+            fail("new_message failed", PTR_ERR(msg));
+        if((err = post_message(n, msg, false)) != 0)
+            fail("post_message failed", err);
+    }
+
+    if(has_message(n, &last_seq))
+        fail("a queue has a message newer than its newest", 0);
+
+    err = take_message(n, &last_seq, MAX_FUZZ_LEN, false, &msg);
+    if(err != -EWOULDBLOCK)
+        fail("a newer read of a queue didn't fail with EWOULDBLOCK", err);
+
+    if(!queue_state(n, &count, &capacity) || count != 2)
+        fail("a newer read of a queue took an older message off it", count);
+
+    last_seq = 0;
+    if((err = take_message(n, &last_seq, MAX_FUZZ_LEN, false, &msg)) != 0)
+        fail("take_message failed", err);
+
+    if(msg -> seq != 1)
+        fail("a queue read didn't get the oldest message", (int)msg -> seq);
+
+    put_message(msg);
+    put_node(n);
+
+    if((err = delete_channel(&store, channel_ids + 1)) != 0)
+        fail("delete_channel failed", err);
+}
+
+// Posts a message of 1 byte on the channel
+void post_byte(node* n){
+    message*  msg = new_message(n, 1);
+    int       err;
+
+    if(IS_ERR(msg))
+        fail("new_message failed", PTR_ERR(msg));
+
+    msg -> data[0] = 0;
+    if((err = post_message(n, msg, false)) != 0)
+        fail("post_message failed", err);
+}
+
+// Checks a channel's last message is dropped when it enters queue mode and when it leaves it, on a channel of its own
+void check_mode_switch(void){
+    node*       n = get_channel(&store, channel_ids + 2);
+    message*    msg;
+    int         err;
+
+    if(IS_ERR(n))
+        fail("get_channel failed", PTR_ERR(n));
+
+    post_byte(n);
+
+    if((err = set_queue(n, 4)) != 0)
+        fail("set_queue failed", err);
+
+    if((msg = get_message(n)) != NULL || has_message(n, NULL))
+        fail("the last message outlived entering queue mode", 0);
+
+    post_byte(n);
+
+    if(get_message(n) != NULL)
+        fail("a queued message was published as the last message", 0);
+
+    // leaving queue mode (no new queue) with a queued message is refused, and without one works
+    if(set_queue(n, 0) != -EBUSY)
+        fail("leaving queue mode with a queued message didn't fail with EBUSY", 0);
+
+    if((err = take_message(n, NULL, MAX_FUZZ_LEN, false, &msg)) != 0)
+        fail("take_message failed", err);
+    put_message(msg);
+
+    if((err = set_queue(n, 0)) != 0)
+        fail("set_queue failed", err);
+
+    if(has_message(n, NULL) || take_message(n, NULL, MAX_FUZZ_LEN, false, &msg) != -EWOULDBLOCK)
+        fail("a message showed up after leaving queue mode", 0);
+
+    post_byte(n);
+
+    if((err = take_message(n, NULL, MAX_FUZZ_LEN, false, &msg)) != 0)
+        fail("take_message failed", err);
+    put_message(msg);
+    put_node(n);
+
+    if((err = delete_channel(&store, channel_ids + 2)) != 0)
+        fail("delete_channel failed", err);
+}
+
+void* run_fuzzer(void* arg){
+    fuzzer*         f = arg;
+    unsigned long   channel_id;
+    node*           n;
+    int             k;
+    int             op;
+    int             err;
+
+    for(; f -> ops < ops_per_thread; f -> ops++){
+        channel_id = 1 + rand_r(&f -> seed) % channel_ids;
+        k = rand_r(&f -> seed) % HELD;
+        op = rand_r(&f -> seed) % 100;
+
+        // hold a channel, like setting a file's channel
+        if(op < 10){
+            n = get_channel(&store, channel_id);
+            if(IS_ERR(n)){
+                if(PTR_ERR(n) != -EDQUOT)
+                    fail("get_channel failed", PTR_ERR(n));
+                continue;
+            }
+            set_node(&f -> held[k], n);
+            f -> last_seq[k] = 0;
+        }
+        else if(op < 12){
+            set_node(&f -> held[k], NULL);
+        }
+        else if(op < 15){
+            err = delete_channel(&store, channel_id);
+            if(err != 0 && err != -ENOENT)
+                fail("delete_channel failed", err);
+        }
+        else if(op < 16){
+            evict_idle(&store, rand_r(&f -> seed) % 2);
+        }
+        else if((n = pick_node(f, k, channel_id)) != NULL){
+            if(op < 45){
+                write_op(f, n);
+            }
+            else if(op < 93){
+                read_op(f, n, k, op >= 80 && n == f -> held[k]);
+            }
+            else{
+                err = set_queue(n, rand_r(&f -> seed) % 3 == 0 ? 0 : 1 + rand_r(&f -> seed) % 16);
+                if(err != 0 && err != -EBUSY && err != -EIDRM && err != -EDQUOT)
+                    fail("set_queue failed", err);
+            }
+            put_node(n);
+        }
+    }
+
+    for(k = 0; k < HELD; k++)
+        set_node(&f -> held[k], NULL);
+
+    rcu_thread_exit();
+
+    return NULL;
+}
+
+void usage(char* prog){
+    fprintf(stderr, "usage: %s [options]\n"
+                    "options:\n"
+                    "  -t  threads (default 8)\n"
+                    "  -n  operations per thread (default 200000)\n"
+                    "  -c  channel ids the threads share (default 64)\n"
+                    "  -m  memory cap of the store in bytes, 0 for none (default 262144)\n"
+                    "  -s  seed (default the time)\n", prog);
+    exit(1);
+}
+
+int main(int argc, char** argv){
+    int             threads = 8;
+    unsigned int    seed = time(NULL);
+    long long       ops = 0;
+    long long       messages = 0;
+    fuzzer*         fuzzers;
+    int             opt;
+
+    max_slot_bytes = 256 * 1024;
+    numa_place = true;
+    align_nodes = true;
+
+    while((opt = getopt(argc, argv, "t:n:c:m:s:")) != -1){
+        switch(opt){
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'n':
+                ops_per_thread = atoll(optarg);
+                break;
+            case 'c':
+                channel_ids = strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                max_slot_bytes = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if(threads <= 0 || ops_per_thread <= 0 || channel_ids == 0)
+        usage(argv[0]);
+
+    printf("fuzzing with %d threads, %lld ops each, %lu channel ids, seed %u\n", threads, ops_per_thread,
+           channel_ids, seed);
+
+    if(store_init() != 0)
+        fail("store_init failed", 0);
+
+    init_store(&store);
+    check_queue_seq();
+    check_mode_switch();
+
+    fuzzers = calloc(threads, sizeof(fuzzer));
+    if(fuzzers == NULL)
+        fail("calloc failed", 0);
+
+    for(int i = 0; i < threads; i++){
+        fuzzers[i].seed = seed + i;
+        if(pthread_create(&fuzzers[i].thread, NULL, run_fuzzer, &fuzzers[i]) != 0)
+            fail("pthread_create failed", i);
+    }
+
+    for(int i = 0; i < threads; i++){
+        pthread_join(fuzzers[i].thread, NULL);
+        ops += fuzzers[i].ops;
+        messages += fuzzers[i].messages;
+    }
+
+    destroy_store(&store);
+    rcu_barrier();
+
+    if(atomic_read(&store.num_of_nodes) != 0)
+        fail("channels are left after deleting all of them", atomic_read(&store.num_of_nodes));
+
+    if(atomic_long_read(&store.bytes) != 0 || atomic_long_read(&total_bytes) != 0)
+        fail("bytes are still counted after deleting all channels", (int)atomic_long_read(&store.bytes));
+
+    store_exit();
+
+    if(shim_leaks != 0)
+        fail("nodes or messages were leaked", (int)shim_leaks);
+
+    printf("ok - %lld operations, %lld messages read\n", ops, messages);
+    free(fuzzers);
+
+    return 0;
+}
+
+// make store_fuzz, or:
+// gcc -O1 -g -Wall -std=gnu11 -pthread -fsanitize=address,undefined store_fuzz.c channel_store.c channel_store_user.c -o store_fuzz
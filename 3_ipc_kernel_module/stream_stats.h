@@ -0,0 +1,102 @@
+#ifndef EX3_STREAM_STATS_H
+#define EX3_STREAM_STATS_H
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Throughput and latency statistics of the streaming modes of message_sender and message_reader,
+ * reported to stderr when they exit (stdout may be carrying messages).
+ * The latency of each call (an ioctl or a read moving one or more messages) goes to a histogram of
+ * 16 buckets per power of 2 of nanoseconds, so percentiles are within about 6%.
+ */
+
+#define STATS_SUB_BUCKETS 16
+#define STATS_BUCKETS (64 * STATS_SUB_BUCKETS)
+
+typedef struct stream_stats{
+    long long start;
+    long long messages;
+    long long bytes;
+    long long failed;
+    long long calls;
+    long long total_ns;
+    long long max_ns;
+    long long hist[STATS_BUCKETS];
+}stream_stats;
+
+static inline long long now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline void stats_init(stream_stats* s){
+    memset(s, 0, sizeof(*s));
+    s -> start = now_ns();
+}
+
+static inline int stats_bucket(long long ns){
+    int exp;
+
+    if(ns < STATS_SUB_BUCKETS)
+        return ns < 0 ? 0 : ns;
+
+    exp = 63 - __builtin_clzll(ns);
+    return (exp - 3) * STATS_SUB_BUCKETS + ((ns >> (exp - 4)) & (STATS_SUB_BUCKETS - 1));
+}
+
+// the lowest latency of a bucket
+static inline long long stats_bucket_ns(int bucket){
+    int exp = bucket / STATS_SUB_BUCKETS + 3;
+
+    if(bucket < STATS_SUB_BUCKETS)
+        return bucket;
+
+    return (long long)(STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS) << (exp - 4);
+}
+
+// Records a call that took ns and moved messages messages of bytes bytes in total
+static inline void stats_add(stream_stats* s, long long ns, long long messages, long long bytes){
+    s -> calls++;
+    s -> messages += messages;
+    s -> bytes += bytes;
+    s -> total_ns += ns;
+    s -> hist[stats_bucket(ns)]++;
+
+    if(ns > s -> max_ns)
+        s -> max_ns = ns;
+}
+
+// Returns the latency p (0 - 1) of the calls took at most
+static inline long long stats_percentile(stream_stats* s, double p){
+    long long rank = (long long)(p * s -> calls);
+    long long seen = 0;
+
+    for(int i = 0; i < STATS_BUCKETS; i++){
+        seen += s -> hist[i];
+        if(seen > rank)
+            return stats_bucket_ns(i);
+    }
+
+    return s -> max_ns;
+}
+
+static inline void stats_report(stream_stats* s, const char* prog, const char* call){
+    double secs = (now_ns() - s -> start) / 1e9;
+
+    fprintf(stderr, "%s: %lld messages, %lld bytes in %.3f s - %.0f messages/s, %.2f MB/s\n", prog,
+            s -> messages, s -> bytes, secs, s -> messages / secs, s -> bytes / secs / 1e6);
+
+    if(s -> calls > 0){
+        fprintf(stderr, "%s: %lld %s calls, latency avg %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n", prog,
+                s -> calls, call, s -> total_ns / 1e3 / s -> calls, stats_percentile(s, 0.5) / 1e3,
+                stats_percentile(s, 0.99) / 1e3, s -> max_ns / 1e3);
+    }
+
+    if(s -> failed > 0)
+        fprintf(stderr, "%s: %lld messages failed\n", prog, s -> failed);
+}
+
+#endif
@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Checks pfind -g against find -name (fnmatch) on names made to trip glob translation:
+# brackets with no closing ], a ] right after [ or [!, character classes and regex metacharacters.
+# Exits with 1 on the first glob whose matches differ.
+#
+# usage: ./glob_test.sh [path of pfind]
+
+cd "$(dirname "$0")" || exit 1
+
+pfind=$1
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+if [ -z "$pfind" ]; then
+    pfind=$tmp/pfind
+    gcc -O2 -Wall -pthread pfind.c -o "$pfind" || exit 1
+fi
+
+mkdir "$tmp/tree" "$tmp/tree/sub"
+for name in '[]x' '[!]' ']x' 'ax' 'bx' '[x' 'a]' 'x[y' 'a.b' 'aab' 'A1' 'a+b' '(a)' 'a|b' '!x' '^x'; do
+    touch "$tmp/tree/$name" "$tmp/tree/sub/$name"
+done
+
+failed=0
+
+for glob in '[]x' '[!]' '[]]x' '[!]]x' '[]a]x' '[!]a]x' '[' '[x' 'x[' '*[' '[ab]x' '[!ab]x' '[[:alpha:]]x' \
+            '[[:upper:]][[:digit:]]' '?x' 'a*' '*]' 'a.b' 'a?b' 'a+b' '(a)' 'a|b' '[!!]x' '[\^]x' '*'; do
+    expected=$(find "$tmp/tree" -mindepth 1 -type f -name "$glob" | sort)
+    got=$("$pfind" -g "$tmp/tree" "$glob" 4 | grep -v '^Done searching' | sort)
+
+    if [ "$got" != "$expected" ]; then
+        echo "FAIL: -g '$glob'"
+        echo "  expected: $(echo $expected)"
+        echo "  got:      $(echo $got)"
+        failed=1
+    fi
+done
+
+[ $failed -eq 0 ] && echo "ok - pfind -g matches find -name"
+exit $failed
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <dirent.h>
 #include <errno.h>
@@ -7,57 +8,182 @@
 #include <ftw.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <regex.h>
+#include <ctype.h>
+
+// bytes of directory entries each getdents64 call reads
+#define DENTS_BUF_LEN (128 * 1024)
+
+// bytes of each chunk of a thread's arena of directory records
+#define ARENA_CHUNK (1 << 20)
+
+// bytes of a thread's output buffer
+#define OUT_BUF_LEN (64 * 1024)
+
+// a directory entry as getdents64 returns it
+struct linux_dirent64{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// ---------------------- directory structs ---------------------- //
+
+// A directory to search: its name and its parent's record, so a path is never stored whole and a name
+// is copied only once, from getdents64's buffer into the record. A thread rebuilds the path of a directory it searches
+typedef struct dir_rec{
+    struct dir_rec* parent;     // NULL for the search root
+    size_t len;
+    char name[];
+}dir_rec;
+
+// A thread's bump allocator of dir_recs. Records are never freed one by one - a record is the parent of
+// the records of its subdirectories, so they all live until the search is done
+typedef struct arena{
+    char* chunk;    // starts with a pointer to the previous chunk
+    size_t used;
+    size_t size;
+    long bytes;     // bytes of records
+}arena;
+
+// The directories a thread has to search. Its owner pushes and pops at the bottom (the newest first),
+// idle threads steal from the top - the oldest, nearest the root, with the most work under them
+typedef struct deque{
+    pthread_mutex_t lock;
+    dir_rec** dirs;
+    int capacity;
+    int top;            // index of the oldest dir
+    atomic_int size;    // read without the lock, to skip empty deques
+}deque;
+
+// a thread's buffer of the path of the directory it searches
+typedef struct path_buf{
+    char* str;
+    size_t size;
+}path_buf;
+
+// How names are matched against the search terms - a name matches if any term matches it
+typedef enum match_mode{
+    MATCH_SUBSTRING,    // the term is part of the name (default)
+    MATCH_GLOB,         // the whole name matches the term as a shell glob (-g)
+    MATCH_REGEX         // the name has a match of the term as a POSIX extended regex (-r)
+}match_mode;
+
+/*
+ * The search terms, compiled once before the threads start.
+ * Substrings go into an Aho-Corasick automaton, turned into a DFA over bytes: matching a name is a table
+ * lookup per byte, however many terms there are. Globs are translated to regexes, and each regex is
+ * compiled on its own. Each thread gets its own compiled copies, since glibc's regexec locks its regex_t
+ */
+typedef struct matcher{
+    match_mode mode;
+    bool ignore_case;
 
-// ---------------------- linked list structs ---------------------- //
+    int (*next)[256];       // next[state][byte] of the DFA, state 0 the start
+    bool* accepting;        // whether a term ends at the state (or at a suffix of it)
+    int num_states;
+    unsigned char fold[256];
 
-typedef struct node{
-    char* str;
-    struct node* next;
-}node;
+    regex_t* regexes;       // thread id's copy of term t at [id * num_terms + t]
+}matcher;
 
-typedef struct queue{
-    node* head;
-    node* tail;
-    int size;
-}queue;
+// A thread's output: whole records (lines, or NUL-terminated paths with -0), written to stdout when it's full
+typedef struct out_buf{
+    char* data;
+    size_t used;
+}out_buf;
 
 // ---------------------- global variables ---------------------- //
 
-queue* q;
+deque* deques;
+arena* arenas;
+matcher match;
+char** terms;
+int num_terms = 0;
 atomic_int counter = 0;        // counter for files that contains the searching term
 bool running = false;
 int num_of_threads;
 int living_threads = 0;
 bool all_threads_created;
-int active_threads = 0;
-bool waiting_threads_on_empty_queue = false;
 
-// lock for all operations that read/write data to/from the queue
-pthread_mutex_t lock_queue;
+// directories that were pushed and weren't searched yet - the search is done when it drops to 0
+atomic_long outstanding = 0;
+
+// threads that found no directory to search and wait for one
+atomic_int idle_threads = 0;
+
+// calls to malloc / realloc (xmalloc, xrealloc), reported with -s
+atomic_long alloc_calls = 0;
+bool print_stats = false;
+
+// ends each path printed: '\n', or '\0' with -0 (then the other messages go to stderr)
+char terminator = '\n';
 
 // lock and cv for the starting signal
 pthread_mutex_t lock_running;
 pthread_cond_t cv_running;
 
-// lock for all operations that read/write data to/from active_threads variable
-pthread_mutex_t lock_active_threads;
-
 pthread_cond_t cv_all_threads_created;
-pthread_cond_t cv_waiting_threads_on_empty_queue;
 
-// cv for threads that tried to deque a non empty queue
-// when there are threads that were waiting on an empty queue
-pthread_cond_t cv_stealing_threads;
+// lock and cv for idle threads: signaled when a directory is pushed, broadcast when the search is done
+pthread_mutex_t lock_idle;
+pthread_cond_t cv_work;
+
+// lock for writing to stdout - a buffer is written whole, so records of different threads never interleave
+pthread_mutex_t lock_output;
 
 // ---------------------- auxiliary functions ---------------------- //
 
 int validate_cli_args(int argc, char** argv){
-    if(argc != 4){
+    int opt;
+
+    // the search term and the -e ones
+    terms = malloc(sizeof(char*) * argc);
+    if(terms == NULL){
+        fprintf(stderr, "Error: malloc() failed.\n");
+        return 1;
+    }
+
+    while((opt = getopt(argc, argv, "+s0e:igr")) != -1){
+        if(opt == 's'){
+            print_stats = true;
+        }
+        else if(opt == '0'){
+            terminator = '\0';
+        }
+        else if(opt == 'e'){
+            terms[num_terms++] = optarg;
+        }
+        else if(opt == 'i'){
+            match.ignore_case = true;
+        }
+        else if(opt == 'g' || opt == 'r'){
+            if(match.mode != MATCH_SUBSTRING){
+                fprintf(stderr, "Error: -g and -r can't be used together.\n");
+                return 1;
+            }
+            match.mode = opt == 'g' ? MATCH_GLOB : MATCH_REGEX;
+        }
+        else{
+            fprintf(stderr, "Error: unknown option.\n");
+            return 1;
+        }
+    }
+
+    if(argc - optind != 3){
         fprintf(stderr, "Error: wrong number of CLI args.\n");
         return 1;
     }
 
-    DIR* dir = opendir(argv[1]);
+    DIR* dir = opendir(argv[optind]);
     if(dir){
         if(closedir(dir))
             return 4;
@@ -71,188 +197,650 @@ int validate_cli_args(int argc, char** argv){
     }
 }
 
-char* get_file_name(char* dir_name, char* suffix){
-    char* file_name;
-    if(dir_name[strlen(dir_name) - 1] == '/'){
-        file_name = malloc(strlen(dir_name) + strlen(suffix) + 1);
-        strcpy(file_name, dir_name);
-        strcat(file_name, suffix);
-    }
-    else{
-        file_name = malloc(strlen(dir_name) + strlen(suffix) + 2);
-        strcpy(file_name, dir_name);
-        strcat(file_name, "/");
-        strcat(file_name, suffix);
+void* xmalloc(size_t size){
+    void* ptr = malloc(size);
+
+    atomic_fetch_add(&alloc_calls, 1);
+
+    if(ptr == NULL){
+        fprintf(stderr, "Error: malloc() failed.\n");
+        exit(1);
     }
-    return file_name;
+
+    return ptr;
 }
 
-void update_active_threads(char sign){
-    pthread_mutex_lock(&lock_active_threads);
-    if(sign == '-')
-        active_threads--;
-    else
-        active_threads++;
-    pthread_mutex_unlock(&lock_active_threads);
+void* xrealloc(void* ptr, size_t size){
+    ptr = realloc(ptr, size);
+
+    atomic_fetch_add(&alloc_calls, 1);
+
+    if(ptr == NULL){
+        fprintf(stderr, "Error: realloc() failed.\n");
+        exit(1);
+    }
+
+    return ptr;
 }
 
 int open_dir_failure(char* dir_name){
     if (errno == ENOENT){
         fprintf(stderr, "Error: directory %s doesn't exist.\n", dir_name);
-        update_active_threads('-');
         return 1;
     }
     else{
         fprintf(stderr, "Error: opendir() failed.\n");
-        update_active_threads('-');
         return 2;
     }
 }
 
-// ---------------------- linked list functions ---------------------- //
+// ---------------------- matching functions ---------------------- //
 
-int init_queue(char* search_dir){
-    if(search_dir == NULL){
-        fprintf(stderr, "Error: search_dir = NULL\n");
-        exit(1);
-    }
+// Builds the Aho-Corasick DFA of the terms (folded to lower case with -i)
+void build_automaton(){
+    int max_states = 1;
+
+    for(int i = 0; i < num_terms; i++)
+        max_states += strlen(terms[i]);
+
+    match.next = xmalloc(sizeof(*match.next) * max_states);
+    match.accepting = calloc(max_states, sizeof(bool));
+    int* fail = xmalloc(sizeof(int) * max_states);
+    int* bfs = xmalloc(sizeof(int) * max_states);
 
-    q = malloc(sizeof (queue));
-    if(q == NULL){
+    if(match.accepting == NULL){
         fprintf(stderr, "Error: malloc() failed.\n");
         exit(1);
     }
 
-    node* n = malloc(sizeof (node));
-    if(n == NULL){
-        fprintf(stderr, "Error: malloc() failed.\n");
-        exit(1);
+    for(int c = 0; c < 256; c++)
+        match.fold[c] = match.ignore_case ? tolower(c) : c;
+
+    // the trie of the terms
+    memset(match.next[0], -1, sizeof(match.next[0]));
+    match.num_states = 1;
+
+    for(int i = 0; i < num_terms; i++){
+        int state = 0;
+
+        for(unsigned char* c = (unsigned char*)terms[i]; *c; c++){
+            if(match.next[state][match.fold[*c]] == -1){
+                memset(match.next[match.num_states], -1, sizeof(match.next[0]));
+                match.next[state][match.fold[*c]] = match.num_states++;
+            }
+            state = match.next[state][match.fold[*c]];
+        }
+
+        match.accepting[state] = true;
     }
 
-    if(search_dir[strlen(search_dir) - 1] == '/'){
-        n -> str = malloc(strlen(search_dir) + 1);
-        strcpy(n -> str, search_dir);
+    // breadth first, so a state's failure state (its longest proper suffix in the trie) is done before it.
+    // A missing transition becomes its failure state's, which makes the trie a DFA
+    int head = 0, tail = 0;
+
+    for(int c = 0; c < 256; c++){
+        if(match.next[0][c] == -1){
+            match.next[0][c] = 0;
+        }
+        else{
+            fail[match.next[0][c]] = 0;
+            bfs[tail++] = match.next[0][c];
+        }
     }
-    else{
-        n -> str = malloc(strlen(search_dir) + 2);
-        strcpy(n -> str, search_dir);
-        strcat(n -> str, "/");
+
+    while(head < tail){
+        int state = bfs[head++];
+
+        match.accepting[state] |= match.accepting[fail[state]];
+
+        for(int c = 0; c < 256; c++){
+            int child = match.next[state][c];
+
+            if(child == -1){
+                match.next[state][c] = match.next[fail[state]][c];
+            }
+            else{
+                fail[child] = match.next[fail[state]][c];
+                bfs[tail++] = child;
+            }
+        }
     }
 
-    n -> next = NULL;
+    free(fail);
+    free(bfs);
+}
 
-    q -> head = n;
-    q -> tail = n;
-    q -> size = 1;
+// Returns the ] that closes the glob bracket expression starting at c (its [), NULL if none does
+char* bracket_end(char* c){
+    c++;
+    if(*c == '!' || *c == '^')
+        c++;
+
+    // a ] right after [ or [! is part of the set
+    if(*c == ']')
+        c++;
+
+    for(; *c && *c != ']'; c++){
+        // a class ([:alpha:], [.a.] or [=a=]) ends with its own :] .] or =]
+        if(c[0] == '[' && (c[1] == ':' || c[1] == '.' || c[1] == '=')){
+            char* e = c + 2;
+
+            while(*e && !(e[0] == c[1] && e[1] == ']'))
+                e++;
+            if(*e)
+                c = e + 1;
+        }
+    }
 
-    return 0;
+    return *c ? c : NULL;
 }
 
-node* create_node(char* file_name){
-    node* new_node = malloc(sizeof (node));
-    if(file_name[strlen(file_name) - 1] == '/'){
-        new_node -> str = malloc(strlen(file_name) + 1);
-        strcpy(new_node -> str, file_name);
-        new_node -> str[strlen(file_name)] = '\0';
+// Appends glob to the regex buffer as an extended regex that matches the same names
+char* glob_to_regex(char* regex, char* glob){
+    char* end;
+
+    for(char* c = glob; *c; c++){
+        if(*c == '*'){
+            *regex++ = '.';
+            *regex++ = '*';
+        }
+        else if(*c == '?'){
+            *regex++ = '.';
+        }
+        else if(*c == '[' && (end = bracket_end(c)) != NULL){
+            // a bracket expression is the same in both, but for [! which is [^
+            *regex++ = *c++;
+            if(*c == '!' || *c == '^'){
+                *regex++ = '^';
+                c++;
+            }
+            while(c < end)
+                *regex++ = *c++;
+            *regex++ = ']';
+        }
+        else{
+            // as in fnmatch, a [ that no ] closes is just a [
+            if(*c == '\\' && c[1] != '\0')
+                c++;
+            if(strchr(".^$+(){}|\\[]", *c))
+                *regex++ = '\\';
+            *regex++ = *c;
+        }
     }
-    else{
-        new_node -> str = malloc(strlen(file_name) + 2);
-        strcpy(new_node -> str, file_name);
-        strcat(new_node -> str, "/");
-        new_node -> str[strlen(file_name) + 1] = '\0';
+
+    return regex;
+}
+
+// Compiles each term (glob or regex) on its own - pasted into one alternation, a ) of one term
+// would change what the others mean. A copy of all of them for each thread
+void compile_regexes(){
+    size_t len = 0;
+
+    for(int i = 0; i < num_terms; i++){
+        if(strlen(terms[i]) > len)
+            len = strlen(terms[i]);
+    }
+
+    // a glob doubles at most (*), and matches the whole name: ^(g)$
+    char* regex = xmalloc(2 * len + 8);
+
+    match.regexes = xmalloc(sizeof(regex_t) * num_of_threads * num_terms);
+
+    for(int t = 0; t < num_terms; t++){
+        char* pattern = terms[t];
+
+        if(match.mode == MATCH_GLOB){
+            char* end = regex;
+
+            *end++ = '^';
+            *end++ = '(';
+            end = glob_to_regex(end, terms[t]);
+            *end++ = ')';
+            *end++ = '$';
+            *end = '\0';
+            pattern = regex;
+        }
+
+        for(int i = 0; i < num_of_threads; i++){
+            regex_t* r = &match.regexes[i * num_terms + t];
+            int rc = regcomp(r, pattern, REG_EXTENDED | REG_NOSUB | (match.ignore_case ? REG_ICASE : 0));
+
+            if(rc){
+                char error[256];
+                regerror(rc, r, error, sizeof(error));
+                fprintf(stderr, "Error: bad %s %s: %s\n", match.mode == MATCH_GLOB ? "glob" : "regular expression",
+                        terms[t], error);
+                exit(1);
+            }
+        }
+    }
+
+    free(regex);
+}
+
+void init_matcher(){
+    if(match.mode == MATCH_SUBSTRING)
+        build_automaton();
+    else
+        compile_regexes();
+}
+
+void destroy_matcher(){
+    if(match.mode == MATCH_SUBSTRING){
+        free(match.next);
+        free(match.accepting);
+        return;
+    }
+
+    for(int i = 0; i < num_of_threads * num_terms; i++)
+        regfree(&match.regexes[i]);
+    free(match.regexes);
+}
+
+// Returns whether the name matches any of the terms (id - the thread matching it)
+bool matches(int id, char* name){
+    if(match.mode != MATCH_SUBSTRING){
+        for(int t = 0; t < num_terms; t++){
+            if(regexec(&match.regexes[id * num_terms + t], name, 0, NULL, 0) == 0)
+                return true;
+        }
+        return false;
     }
-    new_node -> next = NULL;
-    return new_node;
+
+    int state = 0;
+
+    // an empty term is part of every name
+    if(match.accepting[0])
+        return true;
+
+    for(unsigned char* c = (unsigned char*)name; *c; c++){
+        state = match.next[state][match.fold[*c]];
+
+        if(match.accepting[state])
+            return true;
+    }
+
+    return false;
 }
 
-void enqueue(char* dir_name){
-    node* new_dir = create_node(dir_name);
+// ---------------------- output functions ---------------------- //
+
+// Writes iovcnt buffers to stdout, all of them (writev may write only a part)
+void write_all(struct iovec* iov, int iovcnt){
+    while(iovcnt > 0){
+        ssize_t written = writev(STDOUT_FILENO, iov, iovcnt);
 
-    pthread_mutex_lock(&lock_queue);
+        if(written < 0){
+            if(errno == EINTR)
+                continue;
+            fprintf(stderr, "Error: writev() failed: %s\n", strerror(errno));
+            exit(1);
+        }
 
-    if(q -> size == 0)
-        q -> head = new_dir;
+        while(iovcnt > 0 && (size_t)written >= iov -> iov_len){
+            written -= iov -> iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        if(iovcnt > 0){
+            iov -> iov_base = (char*)iov -> iov_base + written;
+            iov -> iov_len -= written;
+        }
+    }
+}
+
+void flush_output(out_buf* out){
+    struct iovec iov = {out -> data, out -> used};
+
+    if(out -> used == 0)
+        return;
+
+    pthread_mutex_lock(&lock_output);
+    write_all(&iov, 1);
+    pthread_mutex_unlock(&lock_output);
+
+    out -> used = 0;
+}
+
+// Adds the record a b c + terminator to the thread's output, writing the buffer first if it doesn't fit
+void output_record(out_buf* out, char* a, char* b, char* c){
+    struct iovec iov[4] = {{a, strlen(a)}, {b, strlen(b)}, {c, strlen(c)}, {&terminator, 1}};
+    size_t len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len + 1;
+
+    if(out -> used + len > OUT_BUF_LEN)
+        flush_output(out);
+
+    // a record bigger than the whole buffer is written on its own
+    if(len > OUT_BUF_LEN){
+        pthread_mutex_lock(&lock_output);
+        write_all(iov, 4);
+        pthread_mutex_unlock(&lock_output);
+        return;
+    }
+
+    for(int i = 0; i < 4; i++){
+        memcpy(out -> data + out -> used, iov[i].iov_base, iov[i].iov_len);
+        out -> used += iov[i].iov_len;
+    }
+}
+
+// Reports a directory the thread can't read - on stdout with its other records, or on stderr with -0
+void output_denied(out_buf* out, char* dir_name){
+    if(terminator == '\0')
+        fprintf(stderr, "Directory %s: Permission denied.\n", dir_name);
     else
-        q -> tail -> next = new_dir;
+        output_record(out, "Directory ", dir_name, ": Permission denied.");
+}
+
+// ---------------------- directory record functions ---------------------- //
+
+void* arena_alloc(arena* a, size_t bytes){
+    // keeping records pointer aligned
+    bytes = (bytes + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
 
-    q -> tail = new_dir;
-    q -> size++;
+    if(a -> chunk == NULL || a -> used + bytes > a -> size){
+        size_t size = sizeof(char*) + bytes > ARENA_CHUNK ? sizeof(char*) + bytes : ARENA_CHUNK;
+        char* chunk = xmalloc(size);
+
+        *(char**)chunk = a -> chunk;
+        a -> chunk = chunk;
+        a -> used = sizeof(char*);
+        a -> size = size;
+    }
 
-    pthread_mutex_unlock(&lock_queue);
+    void* ptr = a -> chunk + a -> used;
+    a -> used += bytes;
+    a -> bytes += bytes;
 
-    // broadcast waiting threads on empty queue
-    pthread_cond_broadcast(&cv_waiting_threads_on_empty_queue);
+    return ptr;
 }
 
-char* dequeue(){
-    pthread_mutex_lock(&lock_queue);
+void free_arenas(){
+    for(int i = 0; i < num_of_threads; i++){
+        char* chunk = arenas[i].chunk;
 
-    // A new thread that want to dequeue a non empty queue when there are
-    // threads that were waiting on an empty queue -> has to wait until one of the
-    // waiting threads will dequeue
-    if (waiting_threads_on_empty_queue && q -> size != 0)
-        pthread_cond_wait(&cv_stealing_threads, &lock_queue);
+        while(chunk != NULL){
+            char* prev = *(char**)chunk;
+            free(chunk);
+            chunk = prev;
+        }
+    }
 
-    int is_waiting_thread_on_empty_queue = 0;
+    free(arenas);
+}
 
-    while(q -> size == 0){
+// Makes the record of a directory named name (len bytes) in parent, in the arena
+dir_rec* new_dir_rec(arena* a, dir_rec* parent, char* name, size_t len){
+    dir_rec* rec = arena_alloc(a, sizeof(dir_rec) + len + 1);
 
-        pthread_mutex_lock(&lock_active_threads);
-        if(active_threads == 0){
-            pthread_mutex_unlock(&lock_queue);
-            pthread_mutex_unlock(&lock_active_threads);
+    rec -> parent = parent;
+    rec -> len = len;
+    memcpy(rec -> name, name, len);
+    rec -> name[len] = '\0';
 
-            // broadcast waiting threads on empty queue
-            pthread_cond_broadcast(&cv_waiting_threads_on_empty_queue);
+    return rec;
+}
 
-            // broadcast threads that tried to deque a non empty queue
-            // when there are threads that were waiting on an empty queue
-            pthread_cond_broadcast(&cv_stealing_threads);
+// whether a path ending with the directory has to be followed by a '/' before a name in it
+bool needs_sep(dir_rec* rec){
+    return rec -> len == 0 || rec -> name[rec -> len - 1] != '/';
+}
+
+// Writes the path of a directory (its ancestors' names joined with '/') to the path buffer, growing it if needed
+char* build_path(path_buf* p, dir_rec* rec){
+    size_t len = 0;
+
+    for(dir_rec* r = rec; r != NULL; r = r -> parent)
+        len += r -> len + (r -> parent != NULL && needs_sep(r -> parent));
+
+    if(len + 1 > p -> size){
+        p -> size = 2 * (len + 1);
+        p -> str = xrealloc(p -> str, p -> size);
+    }
+
+    p -> str[len] = '\0';
 
-            pthread_exit((void *)EXIT_SUCCESS);
+    for(dir_rec* r = rec; r != NULL; r = r -> parent){
+        len -= r -> len;
+        memcpy(p -> str + len, r -> name, r -> len);
+
+        if(r -> parent != NULL && needs_sep(r -> parent))
+            p -> str[--len] = '/';
+    }
+
+    return p -> str;
+}
+
+// ---------------------- deque functions ---------------------- //
+
+int init_deques(char* search_dir){
+    if(search_dir == NULL){
+        fprintf(stderr, "Error: search_dir = NULL\n");
+        exit(1);
+    }
+
+    deques = calloc(num_of_threads, sizeof(deque));
+    arenas = calloc(num_of_threads, sizeof(arena));
+    atomic_fetch_add(&alloc_calls, 2);
+
+    if(deques == NULL || arenas == NULL){
+        fprintf(stderr, "Error: malloc() failed.\n");
+        exit(1);
+    }
+
+    for(int i = 0; i < num_of_threads; i++){
+        int rc = pthread_mutex_init(&deques[i].lock, NULL);
+
+        if (rc) {
+            fprintf(stderr, "ERROR in pthread_mutex_init(): %s\n", strerror(rc));
+            exit(1);
         }
-        pthread_mutex_unlock(&lock_active_threads);
+    }
 
-        waiting_threads_on_empty_queue = true;
-        is_waiting_thread_on_empty_queue = 1;
-        pthread_cond_wait(&cv_waiting_threads_on_empty_queue, &lock_queue);
+    return 0;
+}
+
+void destroy_deques(){
+    for(int i = 0; i < num_of_threads; i++){
+        pthread_mutex_destroy(&deques[i].lock);
+        free(deques[i].dirs);
     }
 
-    // Changing the flag when one of the waiting threads on empty queue managed to dequeue
-    if(waiting_threads_on_empty_queue && is_waiting_thread_on_empty_queue){
-        waiting_threads_on_empty_queue = false;
+    free(deques);
+}
+
+// Pushes a directory to the bottom of the thread's deque
+void push_dir(int id, dir_rec* dir){
+    deque* d = &deques[id];
+
+    // counted before anyone can take it, so outstanding never drops to 0 while it waits
+    atomic_fetch_add(&outstanding, 1);
+
+    pthread_mutex_lock(&d -> lock);
+
+    if(d -> size == d -> capacity){
+        int new_capacity = d -> capacity ? 2 * d -> capacity : 64;
+        dir_rec** dirs = xmalloc(sizeof(dir_rec*) * new_capacity);
+
+        for(int i = 0; i < d -> size; i++)
+            dirs[i] = d -> dirs[(d -> top + i) % d -> capacity];
 
-        // broadcast threads that tried to deque a non empty queue
-        // when there are threads that were waiting on an empty queue
-        // so that these threads won't be labeled as "stealing"
-        pthread_cond_broadcast(&cv_stealing_threads);
+        free(d -> dirs);
+        d -> dirs = dirs;
+        d -> capacity = new_capacity;
+        d -> top = 0;
     }
 
-    update_active_threads('+');
+    d -> dirs[(d -> top + d -> size) % d -> capacity] = dir;
+    atomic_fetch_add(&d -> size, 1);
 
-    node* curr_node = q -> head;
+    pthread_mutex_unlock(&d -> lock);
 
-    char* dir_name = malloc(strlen(curr_node -> str) + 1);
-    strcpy(dir_name, curr_node -> str);
-    dir_name[strlen(curr_node -> str)] = '\0';
+    // an idle thread counts itself before checking the deques, so either it sees the push or we see it
+    if(atomic_load(&idle_threads) > 0){
+        pthread_mutex_lock(&lock_idle);
+        pthread_cond_signal(&cv_work);
+        pthread_mutex_unlock(&lock_idle);
+    }
+}
+
+// Pops the newest directory of the deque (bottom), or steals its oldest one (top). NULL if it's empty
+dir_rec* take_dir(deque* d, bool steal){
+    dir_rec* dir = NULL;
 
-    q -> size--;
-    q -> head = q -> head -> next;
+    if(atomic_load(&d -> size) == 0)
+        return NULL;
 
-    if(curr_node != NULL){
-        if(curr_node -> str != NULL)
-            free(curr_node -> str);
-        free(curr_node);
+    pthread_mutex_lock(&d -> lock);
+
+    if(d -> size > 0){
+        if(steal){
+            dir = d -> dirs[d -> top];
+            d -> top = (d -> top + 1) % d -> capacity;
+        }
+        else{
+            dir = d -> dirs[(d -> top + d -> size - 1) % d -> capacity];
+        }
+        atomic_fetch_sub(&d -> size, 1);
     }
 
-    pthread_mutex_unlock(&lock_queue);
+    pthread_mutex_unlock(&d -> lock);
 
-    return dir_name;
+    return dir;
+}
+
+bool has_work(){
+    for(int i = 0; i < num_of_threads; i++){
+        if(atomic_load(&deques[i].size) > 0)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Returns the next directory for the thread to search: its own newest one, or one stolen from
+ * the top of another thread's deque, starting from a random victim. Waits while there is none.
+ * @return the directory, or NULL when the search is done (nothing is outstanding)
+ */
+dir_rec* get_dir(int id, unsigned int* seed){
+    dir_rec* dir;
+
+    while(1){
+        if((dir = take_dir(&deques[id], false)) != NULL)
+            return dir;
+
+        int first = rand_r(seed) % num_of_threads;
+
+        for(int i = 0; i < num_of_threads; i++){
+            int victim = (first + i) % num_of_threads;
+
+            if(victim != id && (dir = take_dir(&deques[victim], true)) != NULL)
+                return dir;
+        }
+
+        pthread_mutex_lock(&lock_idle);
+        atomic_fetch_add(&idle_threads, 1);
+
+        while(atomic_load(&outstanding) != 0 && !has_work())
+            pthread_cond_wait(&cv_work, &lock_idle);
+
+        atomic_fetch_sub(&idle_threads, 1);
+        pthread_mutex_unlock(&lock_idle);
+
+        if(atomic_load(&outstanding) == 0)
+            return NULL;
+    }
+}
+
+// Marks a directory taken by get_dir as searched (its subdirectories were pushed). The last one ends the search
+void finish_dir(){
+    if(atomic_fetch_sub(&outstanding, 1) == 1){
+        pthread_mutex_lock(&lock_idle);
+        pthread_cond_broadcast(&cv_work);
+        pthread_mutex_unlock(&lock_idle);
+    }
 }
 
 // ---------------------- searching thread functions ---------------------- //
 
-void* searching_thread(void* symbol){
+/**
+ * Searches a directory: reads its entries in getdents64 batches into buffer and classifies them by d_type,
+ * with fstatat (relative to the directory's fd) only when the filesystem leaves it DT_UNKNOWN.
+ * Adds the matching files to the thread's output and pushes the subdirectories to its deque, as records in its arena
+ * @return 0 on success, 1 if the thread has to exit with an error
+ */
+int search_directory(int id, dir_rec* dir, path_buf* path, char* buffer, out_buf* out){
+    char* dir_name = build_path(path, dir);
+    int fd = open(dir_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if(fd < 0){
+        if(errno == EACCES){
+            output_denied(out, dir_name);
+            return 0;
+        }
+        return open_dir_failure(dir_name) ? 1 : 0;
+    }
+
+    char* sep = needs_sep(dir) ? "/" : "";
+    long bytes;
+
+    while((bytes = syscall(SYS_getdents64, fd, buffer, DENTS_BUF_LEN)) > 0){
+
+        for(long pos = 0; pos < bytes; ){
+
+            struct linux_dirent64* d = (struct linux_dirent64*)(buffer + pos);
+            unsigned char type = d->d_type;
+            pos += d->d_reclen;
+
+            // . or ..
+            if( strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0 )
+                continue;
+
+            if(type == DT_UNKNOWN){
+                struct stat st;
+
+                if(fstatat(fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW)){
+                    fprintf(stderr, "Error: fstatat() failed: %s | filename = %s%s%s\n", strerror(errno),
+                            dir_name, sep, d->d_name);
+                    close(fd);
+                    return 1;
+                }
+
+                type = IFTODT(st.st_mode);
+            }
+
+            // file or symbolic link
+            if(type == DT_REG || type == DT_LNK) {
+                if(matches(id, d->d_name)) {
+                    output_record(out, dir_name, sep, d->d_name);
+                    counter++;
+                }
+            }
+
+            // directory. Other types (fifos, sockets, devices) are skipped
+            else if(type == DT_DIR){
+                push_dir(id, new_dir_rec(&arenas[id], dir, d->d_name, strlen(d->d_name)));
+            }
+        }
+    }
+
+    if(bytes < 0){
+        fprintf(stderr, "Error: getdents64() failed: %s\n", strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    if(close(fd))
+        return 1;
+
+    return 0;
+}
+
+void* searching_thread(void* arg){
+    int id = (int)(long)arg;
+    unsigned int seed = id + 1;
 
     pthread_mutex_lock(&lock_running);
 
@@ -270,100 +858,52 @@ void* searching_thread(void* symbol){
 
     // -------- after signal -------- //
 
-    // running
-    while(1){
-
-        char* dir_name = dequeue();
-        DIR* dir = opendir(dir_name);
+    char* buffer = xmalloc(DENTS_BUF_LEN);
+    path_buf path = {NULL, 0};
+    out_buf out = {xmalloc(OUT_BUF_LEN), 0};
+    long status = EXIT_SUCCESS;
 
-        if(dir){
+    // running
+    dir_rec* dir;
 
-            errno = 0;
-            struct dirent* d;
+    while((dir = get_dir(id, &seed)) != NULL){
 
-            while( NULL != (d = readdir(dir)) ){
+        int failed = search_directory(id, dir, &path, buffer, &out);
+        finish_dir();
 
-                char* file_name = get_file_name(dir_name, d->d_name);
-                struct stat st;
-                int s = lstat(file_name, &st);
-
-                if(s){
-                    fprintf(stderr, "Error: lstat() failed: %s | filename = %s\n", strerror(errno), file_name);
-                    update_active_threads('-');
-                    free(file_name);
-                    free(dir_name);
-                    pthread_exit((void *)EXIT_FAILURE);
-                }
-
-                // . or ..
-                if( strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0 ){
-                    free(file_name);
-                    continue;
-                }
-
-                // file or symbolic link
-                if(S_ISREG(st.st_mode) || S_ISLNK(st.st_mode)) {
-                    if(strstr(d->d_name, symbol)) {
-                        printf("%s\n", file_name);
-                        counter++;
-                    }
-                }
+        if(failed){
+            status = EXIT_FAILURE;
+            break;
+        }
+    }
 
-                // directory
-                else{
+    flush_output(&out);
 
-                    // check permissions
-                    mode_t dir_mode = st.st_mode;
-                    if(!(dir_mode & S_IRUSR)){
-                        printf("Directory %s: Permission denied.\n", file_name);
-                        free(file_name);
-                        continue;
-                    }
+    free(out.data);
+    free(path.str);
+    free(buffer);
+    pthread_exit((void *)status);
+}
 
-                    enqueue(file_name);
-                }
-                free(file_name);
-            }
+// Prints the allocator calls, the bytes of directory records and the peak memory (maximum RSS) of the search
+void report_stats(){
+    struct rusage usage;
+    long record_bytes = 0;
 
-            if(errno != 0){
-                fprintf(stderr, "Error: readdir() failed: %s\n", strerror(errno));
-                update_active_threads('-');
-                free(dir_name);
-                pthread_exit((void *)EXIT_FAILURE);
-            }
+    for(int i = 0; i < num_of_threads; i++)
+        record_bytes += arenas[i].bytes;
 
-            update_active_threads('-');
-            free(dir_name);
-        }
-        else if (errno == EACCES){
-            printf("Directory %s: Permission denied.\n", dir_name);
-            free(dir_name);
-            continue;
-        }
-        else if(open_dir_failure(dir_name)){
-            free(dir_name);
-            pthread_exit((void *)EXIT_FAILURE);
-        }
+    getrusage(RUSAGE_SELF, &usage);
 
-        if(closedir(dir)){
-            update_active_threads('-');
-            pthread_exit((void *)EXIT_FAILURE);
-        }
-    }
+    fprintf(stderr, "pfind: %ld allocator calls, %.1f MB of directory records, peak RSS %.1f MB\n",
+            atomic_load(&alloc_calls), record_bytes / 1e6, usage.ru_maxrss / 1e3);
 }
 
 // ---------------------- auxiliary functions - threads ---------------------- //
 
 int init_mutexes_and_cvs(){
 
-    int rc = pthread_mutex_init(&lock_queue, NULL);
-
-    if (rc) {
-        fprintf(stderr, "ERROR in pthread_mutex_init(): %s\n", strerror(rc));
-        exit(1);
-    }
-
-    rc = pthread_mutex_init(&lock_running, NULL);
+    int rc = pthread_mutex_init(&lock_running, NULL);
 
     if (rc) {
         fprintf(stderr, "ERROR in pthread_mutex_init(): %s\n", strerror(rc));
@@ -377,31 +917,31 @@ int init_mutexes_and_cvs(){
         exit(1);
     }
 
-    rc = pthread_mutex_init(&lock_active_threads, NULL);
+    rc = pthread_cond_init(&cv_all_threads_created, NULL);
 
     if (rc) {
-        fprintf(stderr, "ERROR in pthread_mutex_init(): %s\n", strerror(rc));
+        fprintf(stderr, "ERROR in pthread_cond_init(): %s\n", strerror(rc));
         exit(1);
     }
 
-    rc = pthread_cond_init(&cv_all_threads_created, NULL);
+    rc = pthread_mutex_init(&lock_idle, NULL);
 
     if (rc) {
-        fprintf(stderr, "ERROR in pthread_cond_init(): %s\n", strerror(rc));
+        fprintf(stderr, "ERROR in pthread_mutex_init(): %s\n", strerror(rc));
         exit(1);
     }
 
-    rc = pthread_cond_init(&cv_waiting_threads_on_empty_queue, NULL);
+    rc = pthread_cond_init(&cv_work, NULL);
 
     if (rc) {
         fprintf(stderr, "ERROR in pthread_cond_init(): %s\n", strerror(rc));
         exit(1);
     }
 
-    rc = pthread_cond_init(&cv_stealing_threads, NULL);
+    rc = pthread_mutex_init(&lock_output, NULL);
 
     if (rc) {
-        fprintf(stderr, "ERROR in pthread_cond_init(): %s\n", strerror(rc));
+        fprintf(stderr, "ERROR in pthread_mutex_init(): %s\n", strerror(rc));
         exit(1);
     }
 
@@ -409,14 +949,7 @@ int init_mutexes_and_cvs(){
 }
 
 int destroy_mutexes_and_cvs(){
-    int rc = pthread_mutex_destroy(&lock_queue);
-
-    if (rc) {
-        fprintf(stderr, "ERROR in pthread_mutex_destroy(): %s\n", strerror(rc));
-        exit(1);
-    }
-
-    rc = pthread_mutex_destroy(&lock_running);
+    int rc = pthread_mutex_destroy(&lock_running);
 
     if (rc) {
         fprintf(stderr, "ERROR in pthread_mutex_destroy(): %s\n", strerror(rc));
@@ -430,42 +963,42 @@ int destroy_mutexes_and_cvs(){
         exit(1);
     }
 
-    rc = pthread_mutex_destroy(&lock_active_threads);
+    rc = pthread_cond_destroy(&cv_all_threads_created);
 
     if (rc) {
-        fprintf(stderr, "ERROR in pthread_mutex_destroy(): %s\n", strerror(rc));
+        fprintf(stderr, "ERROR in pthread_cond_destroy(): %s\n", strerror(rc));
         exit(1);
     }
 
-    rc = pthread_cond_destroy(&cv_all_threads_created);
+    rc = pthread_mutex_destroy(&lock_idle);
 
     if (rc) {
-        fprintf(stderr, "ERROR in pthread_cond_destroy(): %s\n", strerror(rc));
+        fprintf(stderr, "ERROR in pthread_mutex_destroy(): %s\n", strerror(rc));
         exit(1);
     }
 
-    rc = pthread_cond_destroy(&cv_waiting_threads_on_empty_queue);
+    rc = pthread_cond_destroy(&cv_work);
 
     if (rc) {
         fprintf(stderr, "ERROR in pthread_cond_destroy(): %s\n", strerror(rc));
         exit(1);
     }
 
-    rc = pthread_cond_destroy(&cv_stealing_threads);
+    rc = pthread_mutex_destroy(&lock_output);
 
     if (rc) {
-        fprintf(stderr, "ERROR in pthread_cond_destroy(): %s\n", strerror(rc));
+        fprintf(stderr, "ERROR in pthread_mutex_destroy(): %s\n", strerror(rc));
         exit(1);
     }
 
     return 0;
 }
 
-int create_threads(pthread_t* threads, char* search_term){
+int create_threads(pthread_t* threads){
     for (int i = 0; i < num_of_threads; i++) {
         //printf("***Main: creating thread %d\n", i);
 
-        int rc = pthread_create(&threads[i], NULL, &searching_thread, search_term);
+        int rc = pthread_create(&threads[i], NULL, &searching_thread, (void*)(long)i);
 
         if (rc) {
             fprintf(stderr, "Error: pthread_create() failed: %s\n", strerror(rc));
@@ -496,9 +1029,14 @@ int join_threads(pthread_t* threads, bool* no_thread_with_error){
 }
 
 /**
- * argv[1] = search root directory
- * argv[2] = search term
- * argv[3] = number of searching threads
+ * [-s] - print allocator calls and peak memory to stderr
+ * [-0] - end each path with '\0' instead of '\n' (for xargs -0), other messages go to stderr
+ * [-e term] - one more search term (repeatable) - a file matches if its name matches any of them
+ * [-g] / [-r] - the terms are shell globs matching the whole name / POSIX extended regexes
+ * [-i] - ignore case
+ * argv[optind] = search root directory
+ * argv[optind + 1] = search term (a substring of the names, by default)
+ * argv[optind + 2] = number of searching threads
  */
 
 int main(int argc, char** argv) {
@@ -506,14 +1044,24 @@ int main(int argc, char** argv) {
     if(validate_cli_args(argc, argv))
         exit(EXIT_FAILURE);
 
-    char* search_dir = argv[1];
-    char* search_term = argv[2];
-    num_of_threads = atoi(argv[3]); // assumed argv[3] is a valid integer
+    char* search_dir = argv[optind];
+    terms[num_terms++] = argv[optind + 1];
+    num_of_threads = atoi(argv[optind + 2]); // assumed a valid integer
+
+    if(num_of_threads <= 0){
+        fprintf(stderr, "Error: the number of searching threads must be positive.\n");
+        exit(EXIT_FAILURE);
+    }
 
-    // initialize queue of folders
-    if(init_queue(search_dir))
+    // initialize the threads' deques of folders, the search root in the first one
+    if(init_deques(search_dir))
         exit(EXIT_FAILURE);
 
+    push_dir(0, new_dir_rec(&arenas[0], NULL, search_dir, strlen(search_dir)));
+
+    // compile the terms once, before any thread matches a name
+    init_matcher();
+
     // initialize mutexes & condition variables
     if(init_mutexes_and_cvs())
         exit(EXIT_FAILURE);
@@ -525,7 +1073,7 @@ int main(int argc, char** argv) {
     }
 
     // create threads
-    if(create_threads(threads, search_term))
+    if(create_threads(threads))
         exit(EXIT_FAILURE);
 
     // wait for all threads to be created and waiting and then signal them to start
@@ -545,14 +1093,20 @@ int main(int argc, char** argv) {
     if(join_threads(threads, no_thread_with_error))
         exit(EXIT_FAILURE);
 
-    printf("Done searching, found %d files\n", counter);
+    // threads wrote their records with write(), so this is the last line. With -0 stdout only has paths
+    fprintf(terminator == '\0' ? stderr : stdout, "Done searching, found %d files\n", counter);
 
     // destroy threads
     if(destroy_mutexes_and_cvs())
         exit(EXIT_FAILURE);
 
-    if(q != NULL)
-        free(q);
+    if(print_stats)
+        report_stats();
+
+    destroy_deques();
+    free_arenas();
+    destroy_matcher();
+    free(terms);
 
     if(*no_thread_with_error)
         exit(0);